@@ -329,6 +329,72 @@ struct regex_info {
   /* EXTENSION: 
    * total final captured substrings */
   int total_caps;
+
+  /* EXTENSION: 
+   * the result of parsing the regex, which is done once */
+  int retval;
+
+  /* EXTENSION:
+   * the pattern compiled for the automaton, or NULL when the
+   * pattern is left to the backtracker */
+  struct re_nfa *nfa;
+
+  /* EXTENSION:
+   * a literal that every match contains, or NULL, and the index and the
+   * bytes (both cases) of the literal byte that is looked up first */
+  char *literal;
+  int literal_len;
+  int literal_idx;
+  unsigned char literal_byte[2];
+
+  /* EXTENSION:
+   * where '^' matches, that is the start of the string, or NULL with
+   * RE_NOTBOL */
+  const char *bol;
+};
+
+/* a Thompson automaton, simulated like the Pike VM, that runs in time linear
+ * to the length of the string, and that is tried before the backtracker */
+
+/* the product of instructions and capture slots, bounds the size of the
+ * threads lists, which live in the stack */
+#define RE_NFA_MAX_CELLS 16384
+
+enum {
+  RE_NFA_OP,     /* consumes a byte, see re_match_op () */
+  RE_NFA_SET,    /* consumes a byte, see re_match_set () */
+  RE_NFA_BOL,
+  RE_NFA_EOL,
+  RE_NFA_JMP,
+  RE_NFA_SPLIT,  /* x has priority over y */
+  RE_NFA_SAVE,   /* x is the slot */
+  RE_NFA_MATCH
+};
+
+struct re_nfa_inst {
+  int op;
+  int x;
+  int y;
+  const char *re;  /* points to the op or to the set in the regex */
+  int re_len;
+};
+
+struct re_nfa {
+  struct re_nfa_inst *inst;
+  int num_inst;
+  int num_slots;
+  int is_anchored;
+  int bol;  /* the position where RE_NFA_BOL matches, or -1 */
+
+  /* the instructions that a match can start with, when they all consume */
+  int *first;
+  int num_first;
+};
+
+struct re_nfa_threads {
+  int num;
+  int *pc;
+  int *caps;   /* num_slots for every thread */
 };
 
 /* interpreter */
@@ -448,6 +514,8 @@ NewType (i,
   Type (i) *next;
 );
 
+#define TERM_INPUT_BUF_SIZE 4096
+
 NewProp (term,
   struct termios
     orig_mode,
@@ -465,6 +533,14 @@ NewProp (term,
     orig_curs_col_pos,
     num_rows,
     num_cols;
+
+  TermOnIdle_cb on_idle;
+  void *on_idle_obj;
+
+  /* the bytes that have been read, but not yet consumed */
+  char in_buf[TERM_INPUT_BUF_SIZE];
+  int  in_num_bytes;
+  int  in_idx;
 );
 
 NewType (term,
@@ -496,6 +572,13 @@ NewType (video,
     col_pos;
 
   int *rows;
+
+  /* what is on the screen, so unchanged rows are not redrawn */
+  string_t **frame;
+  int *frame_is_valid;
+
+  /* when a buffer was last drawn, to limit the rate of the deferred draws */
+  long draw_msec;
 );
 
 NewType (arg,
@@ -805,6 +888,77 @@ NewType (ed,
   ed_t *prev;
 );
 
+#define FDLINES_CHUNK_SIZE (1 << 16)
+
+/* reads a file descriptor in big chunks, and returns its lines like getline(),
+ * but pointing into the chunk, instead of copying every line */
+NewType (fdlines,
+  int     fd;
+  int     is_eof;
+  char   *bytes;
+  char    saved;
+  size_t  mem_size;
+  size_t  num_bytes;
+  size_t  offset;
+  size_t  scanned;
+  size_t  saved_idx;
+);
+
+/* the results of :grep for a file, as lines separated by newlines, that are
+ * appended to the search buffer in the order of the files */
+NewType (grepfile,
+  char     *fname;
+  string_t *lines;
+  int       is_done;
+  int       error;
+);
+
+/* the files are shared among the threads, and every thread has its regexp */
+NewType (grep,
+  grepfile_t *files;
+  int
+    num_files,
+    next_file;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t  cond;
+);
+
+NewType (grepworker,
+  grep_t   *grep;
+  regexp_t *re;
+  pthread_t thread;
+);
+
+NewType (bufblock,
+  char   *bytes;
+  size_t  num_bytes;
+
+  bufblock_t *next;
+);
+
+/* a mapped file, where the lines after offset are not rows yet */
+NewType (bufmap,
+  char   *bytes;
+  size_t  num_bytes;
+  size_t  mem_size;
+  size_t  offset;
+  int     fd;
+  dev_t   dev;
+  ino_t   ino;
+  int     progress;
+);
+
+#define BUF_WRITER_NUM_IOV 1024
+
+/* gathers the lines that are written with a single writev() */
+NewType (bufwriter,
+  int     fd;
+  int     num_iov;
+  size_t  num_bytes;
+  struct  iovec iov[BUF_WRITER_NUM_IOV];
+);
+
 NewType (row,
   string_t *data;
 
@@ -814,6 +968,146 @@ NewType (row,
 
    row_t *next;
    row_t *prev;
+
+  /* order statistic index (see buf_rowidx_*()) */
+   row_t *left;
+   row_t *right;
+   int    weight;
+);
+
+/* a row slot in the buffer arena, the row with its string header */
+NewType (bufnode,
+  row_t    row;
+  string_t data;
+);
+
+NewType (bufchunk,
+  char   *bytes;
+  size_t  num_bytes;
+  size_t  mem_size;
+  int     is_referenced;
+
+  bufchunk_t *next;
+);
+
+NewType (bufarena,
+  bufchunk_t
+    *nodes,
+    *payloads;
+
+  row_t *free_rows;
+);
+
+/* a row as the syntax parser rendered it (see buf_render_cache_*()) */
+NewType (rowcache,
+  row_t    *row;
+  string_t *render;
+  uint32_t  hash;
+  size_t    num_bytes;
+
+  int
+    first_col_idx,
+    has_mlcmnt,
+    generation;
+);
+
+NewType (bufcache,
+  rowcache_t *slots;
+  syn_t      *syn;
+  row_t      *idle_first_row;
+
+  int
+    num_slots,
+    generation,
+    num_items,
+    num_cols,
+    tabwidth,
+    idle_generation,
+    idle_idx;
+);
+
+/* the keywords of a syntax, by the hash of their bytes (see syn_keywords_*()) */
+NewType (synkwslot,
+  char     *keyword;
+  uint32_t  hash;
+
+  int
+    len,
+    idx,
+    color;
+);
+
+NewType (synkw,
+  synkwslot_t *slots;
+  uchar       *has_len;
+
+  int
+    num_slots,
+    max_len;
+);
+
+/* whether the rows end in an open multiline comment (see buf_syn_state_*()) */
+NewType (synstate,
+  uchar *in_mlcmnt;
+  syn_t *syn;
+
+  int
+    mem_size,
+    num_items,
+    num_valid;
+);
+
+/* the matches of the last search pattern in the buffer (see buf_match_*()),
+ * as the byte index and the length of every match, and for every row the
+ * index of its first match */
+NewType (bufmatch,
+  regexp_t *re;
+
+  string_t
+    *pat,
+    *render;
+
+  int
+    *row_start,
+    *rows,
+    *cols,
+    *lens,
+    *row_cols,
+    *row_lens,
+    row_mem_size,
+    mem_size,
+    row_num_matches,
+    row_matches_mem_size,
+    num_matches,
+    num_items,
+    num_valid;
+);
+
+/* the byte indices where the screen lines of a wrapped row start */
+NewType (rowwrap,
+  row_t *row;
+  size_t num_bytes;
+
+  int
+    *points,
+    num_points,
+    mem_size,
+    num_cols,
+    tabwidth,
+    generation;
+);
+
+NewType (bufwrap,
+  rowwrap_t *slots;
+  int generation;
+);
+
+NewType (rowidx,
+  row_t *root;
+
+  int
+    is_valid,
+    max_items;
 );
 
 NewProp (buf,
@@ -866,6 +1160,14 @@ NewProp (buf,
 
   term_t    *term_ptr;
   row_t     *video_first_row;
+  bufblock_t *blocks;
+  bufmap_t   map;
+  rowidx_t   rowidx;
+  bufarena_t arena;
+  bufcache_t render_cache;
+  bufwrap_t  wrap_cache;
+  synstate_t synstate;
+  bufmatch_t matches;
   syn_t     *syn;
   ftype_t   *ftype;
   Reg_t     *regs;
@@ -883,6 +1185,7 @@ NewProp (buf,
 
   int shared_int;
   string_t *shared_str;
+  string_t *visible_line;
 );
 
 NewProp (win,
@@ -3308,43 +3308,43 @@ syn_t ex_syn[] = {
     make_keywords, sh_operators,
     sh_singleline_comment, NULL, NULL, NULL,
     HL_STRINGS, HL_NUMBERS,
-    __ex_syn_parser, __ex_make_syn_init, 0, 0, NULL, NULL, NULL,
+    __ex_syn_parser, __ex_make_syn_init, 0, 0, NULL, NULL, NULL, NULL, NULL,
   },
   {
     "sh", __ex_NULL_ARRAY, sh_extensions, sh_shebangs,
     sh_keywords, sh_operators,
     sh_singleline_comment, NULL, NULL, NULL,
     HL_STRINGS, HL_NUMBERS,
-    __ex_syn_parser, __ex_sh_syn_init, 0, 0, NULL, NULL, __ex_balanced_pairs,
+    __ex_syn_parser, __ex_sh_syn_init, 0, 0, NULL, NULL, __ex_balanced_pairs, NULL, NULL,
   },
   {
     "zig", __ex_NULL_ARRAY, zig_extensions, __ex_NULL_ARRAY, zig_keywords, zig_operators,
     zig_singleline_comment, NULL, NULL, NULL, HL_STRINGS, HL_NUMBERS,
-    __ex_syn_parser, __ex_zig_syn_init, 0, 0, NULL, NULL, __ex_balanced_pairs
+    __ex_syn_parser, __ex_zig_syn_init, 0, 0, NULL, NULL, __ex_balanced_pairs, NULL, NULL
   },
   {
     "lua", __ex_NULL_ARRAY, lua_extensions, lua_shebangs, lua_keywords, lua_operators,
     lua_singleline_comment, lua_multiline_comment_start, lua_multiline_comment_end,
     NULL, HL_STRINGS, HL_NUMBERS,
-    __ex_syn_parser, __ex_lua_syn_init, 0, 0, NULL, NULL, __ex_balanced_pairs,
+    __ex_syn_parser, __ex_lua_syn_init, 0, 0, NULL, NULL, __ex_balanced_pairs, NULL, NULL,
   },
   {
     "lai", __ex_NULL_ARRAY, lai_extensions, lai_shebangs, lai_keywords, lai_operators,
     lai_singleline_comment, lai_multiline_comment_start, lai_multiline_comment_end,
     NULL, HL_STRINGS, HL_NUMBERS,
-    __ex_syn_parser, __ex_lai_syn_init, 0, 0, NULL, NULL, __ex_balanced_pairs,
+    __ex_syn_parser, __ex_lai_syn_init, 0, 0, NULL, NULL, __ex_balanced_pairs, NULL, NULL,
   },
   {
     "diff", __ex_NULL_ARRAY, diff_extensions, __ex_NULL_ARRAY,
     __ex_NULL_ARRAY, NULL, NULL, NULL, NULL,
     NULL, HL_STRINGS_NO, HL_NUMBERS_NO,
-    __ex_diff_syn_parser, __ex_diff_syn_init, 0, 0, NULL, NULL, NULL
+    __ex_diff_syn_parser, __ex_diff_syn_init, 0, 0, NULL, NULL, NULL, NULL, NULL
   },
   {
     "md", __ex_NULL_ARRAY, md_extensions, __ex_NULL_ARRAY,
     __ex_NULL_ARRAY, NULL, NULL, NULL, NULL,
     NULL, HL_STRINGS_NO, HL_NUMBERS_NO,
-    __ex_syn_parser, __ex_md_syn_init, 0, 0, NULL, NULL, NULL
+    __ex_syn_parser, __ex_md_syn_init, 0, 0, NULL, NULL, NULL, NULL, NULL
   }
 };
 
@@ -24,6 +24,8 @@
 #include <stdarg.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/select.h>
 #include <sys/types.h>
 #include <sys/param.h>
@@ -34,6 +36,7 @@
 #include <time.h>
 #include <dirent.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "libved.h"
 #include "__libved.h"
@@ -1166,19 +1169,19 @@ private size_t ustring_validate (unsigned char *str, size_t len,
   return 0;
 }
 
-private void ustring_free_members (Ustring_t *u) {
-  ifnot (u->num_items) return;
-  ustring_t *it = u->head;
-  while (it) {
-    ustring_t *tmp = it->next;
-    free (it);
-    it = tmp;
-  }
+private void ustring_clear (Ustring_t *u) {
   u->num_items = 0;
   u->cur_idx = -1;
   u->head = u->tail = u->current = NULL;
 }
 
+private void ustring_free_members (Ustring_t *u) {
+  ifnot (NULL is u->nodes) free (u->nodes);
+  u->nodes = NULL;
+  u->mem_size = 0;
+  ustring_clear (u);
+}
+
 private void ustring_free (Ustring_t *u) {
   if (NULL is u) return;
   ustring_free_members (u);
@@ -1189,34 +1192,96 @@ private Ustring_t *ustring_new (void) {
   return Alloc (sizeof (Ustring_t));
 }
 
+/* the array might move, so the links are set again */
+private void ustring_reserve (Ustring_t *u, int num) {
+  if (num <= u->mem_size) return;
+
+  int mem_size = (u->mem_size ? u->mem_size : 64);
+  while (mem_size < num) mem_size *= 2;
+
+  ustring_t *orig = u->nodes;
+  u->nodes = Realloc (u->nodes, sizeof (ustring_t) * mem_size);
+  u->mem_size = mem_size;
+
+  if (orig is u->nodes or 0 is u->num_items) return;
+
+  for (int i = 0; i < u->num_items; i++) {
+    u->nodes[i].prev = (i ? &u->nodes[i - 1] : NULL);
+    u->nodes[i].next = (i + 1 < u->num_items ? &u->nodes[i + 1] : NULL);
+  }
+
+  u->head = u->nodes;
+  u->tail = &u->nodes[u->num_items - 1];
+  u->current = (u->cur_idx >= 0 ? &u->nodes[u->cur_idx] : NULL);
+}
+
+#define USTRING_ASCII_MASK 0x8080808080808080ULL
+
+/* the characters are appended to the end of the line; plain ascii bytes (as
+ * detected eight at a time) take a fast path without decoding */
 private ustring_t *ustring_encode (Ustring_t *u, char *bytes,
             size_t len, int clear_line, int tabwidth, int curidx) {
-  if (clear_line) ustring_free_members (u);
+  if (clear_line) ustring_clear (u);
 
   ifnot (len) {
     u->num_items = 0;
     return NULL;
   }
 
+  ustring_reserve (u, u->num_items + (int) len + 1);
+
   int curpos = 0;
 
   char *sp = bytes;
+  char *end = bytes + len;
   u->len = 0;
 
   while (*sp) {
+    if (u->num_items is u->mem_size)
+      ustring_reserve (u, u->num_items + 1);
+
+    ustring_t *chr = &u->nodes[u->num_items];
     uchar c = (uchar) *sp;
-    ustring_t *chr = AllocType (ustring);
-    chr->code = c;
-    chr->width = chr->len = 1;
-    chr->buf[0] = *sp;
 
     if (c < 0x80) {
-      if (chr->code is '\t')
-        chr->width += (tabwidth - 1);
-      chr->buf[1] = '\0';
-      goto push;
+      int num = 1;
+      uint64_t w;
+      while (sp + num + 8 <= end) {
+        memcpy (&w, sp + num, 8);
+        if (w & USTRING_ASCII_MASK) break;
+        num += 8;
+      }
+
+      if (u->num_items + num > u->mem_size) {
+        ustring_reserve (u, u->num_items + num);
+        chr = &u->nodes[u->num_items];
+      }
+
+      for (int i = 0; i < num and *sp; i++, sp++, chr++) {
+        c = (uchar) *sp;
+        if (c >= 0x80) break;
+
+        chr->code = c;
+        chr->len = 1;
+        chr->width = (c is '\t' ? tabwidth : 1);
+        chr->buf[0] = c;
+        chr->buf[1] = '\0';
+        chr->next = NULL;
+        chr->prev = (u->num_items ? chr - 1 : NULL);
+        if (chr->prev) chr->prev->next = chr;
+
+        if (curidx is u->len) curpos = u->num_items;
+        u->num_items++;
+        u->len++;
+      }
+
+      continue;
     }
 
+    chr->code = c;
+    chr->width = chr->len = 1;
+    chr->buf[0] = *sp;
+
     chr->buf[1] = *++sp;
     chr->len++;
     chr->code <<= 6; chr->code += (uchar) *sp;
@@ -1247,15 +1312,24 @@ private ustring_t *ustring_encode (Ustring_t *u, char *bytes,
     chr->width += (cwidth (chr->code) - 1);
 
 push:
-    current_list_append (u, chr);
+    chr->next = NULL;
+    chr->prev = (u->num_items ? chr - 1 : NULL);
+    if (chr->prev) chr->prev->next = chr;
+
     if (curidx is u->len or (u->len + (chr->len - 1) is curidx))
-      curpos = u->cur_idx;
+      curpos = u->num_items;
 
+    u->num_items++;
     u->len += chr->len;
     sp++;
   }
 
-  current_list_set (u, curpos);
+  ifnot (u->num_items) return NULL;
+
+  u->head = u->nodes;
+  u->tail = &u->nodes[u->num_items - 1];
+  u->cur_idx = curpos;
+  u->current = &u->nodes[curpos];
   return u->current;
 }
 
@@ -1563,6 +1637,18 @@ private size_t string_align (size_t size) {
 
 /* this is not like realloc(), as len here is the extra size */
 private string_t *string_reallocate (string_t *this, size_t len) {
+  /* a zero mem_size means that the bytes are not owned (see buf block store),
+   * so the first modification that needs space, gets its own copy */
+  ifnot (this->mem_size) {
+    size_t sz = string_align (this->num_bytes + len + 1);
+    char *bytes = Alloc (sz);
+    byte_cp (bytes, this->bytes, this->num_bytes);
+    bytes[this->num_bytes] = '\0';
+    this->bytes = bytes;
+    this->mem_size = sz;
+    return this;
+  }
+
   size_t sz = string_align (this->mem_size + len + 1);
   this->bytes = Realloc (this->bytes, sz);
   this->mem_size = sz;
@@ -2383,7 +2469,28 @@ private void re_allocate_captures (regexp_t *re, int num) {
   re->cap = Alloc (sizeof (capture_t) * re->num_caps);
 }
 
+private void re_nfa_free (struct regex_info *info) {
+  if (NULL is info->nfa) return;
+  free (info->nfa->first);
+  free (info->nfa->inst);
+  free (info->nfa);
+  info->nfa = NULL;
+}
+
+private void re_literal_free (struct regex_info *info) {
+  ifnot (NULL is info->literal) free (info->literal);
+  info->literal = NULL;
+  info->literal_len = 0;
+}
+
 private void re_free_pat (regexp_t *re) {
+  ifnot (NULL is re->prog) {
+    re_nfa_free (re->prog);
+    re_literal_free (re->prog);
+    free (re->prog);
+    re->prog = NULL;
+  }
+
   if (NULL is re->pat) return;
   string_free (re->pat);
   re->pat = NULL;
@@ -2645,7 +2752,7 @@ private int re_bar (const char *re, int re_len, const char *s, int s_len,
       }
       j += n;
     } else if (re[i] == '^') {
-      FAIL_IF(j != 0, RE_NO_MATCH);
+      FAIL_IF(s + j != info->bol, RE_NO_MATCH);
     } else if (re[i] == '$') {
       FAIL_IF(j != s_len, RE_NO_MATCH);
     } else {
@@ -2679,7 +2786,8 @@ private int re_doh (const char *s, int s_len, struct regex_info *info, int bi) {
 }
 
 private int re_baz (const char *s, int s_len, struct regex_info *info) {
-  int i, result = -1, is_anchored = info->brackets[0].ptr[0] == '^';
+  int i, result = -1, is_anchored = info->brackets[0].ptr[0] == '^' &&
+      info->brackets[0].num_branches == 0;
 
   for (i = 0; i <= s_len; i++) {
     result = re_doh (s + i, s_len - i, info, 0);
@@ -2727,14 +2835,16 @@ private void re_setup_branch_points (struct regex_info *info) {
   }
 }
 
-private int re_foo (const char *re, int re_len, const char *s, int s_len,
-               struct regex_info *info) {
+/* this now only parses the regex, and it doesn't check the number of the
+ * captures, as they are given later, at the time of the match */
+private int re_foo (const char *re, int re_len, struct regex_info *info) {
   int i, step, depth = 0;
 
   /* First bracket captures everything */
   info->brackets[0].ptr = re;
   info->brackets[0].len = re_len;
   info->num_brackets = 1;
+  info->num_branches = 0;
 
   /* Make a single pass over regex string, memorize brackets and branches */
   for (i = 0; i < re_len; i += step) {
@@ -2766,8 +2876,6 @@ private int re_foo (const char *re, int re_len, const char *s, int s_len,
       info->brackets[info->num_brackets].ptr = re + i + 1;
       info->brackets[info->num_brackets].len = -1;
       info->num_brackets++;
-      FAIL_IF(info->num_caps > 0 && info->num_brackets - 1 > info->num_caps,
-              RE_CAPS_ARRAY_TOO_SMALL_ERROR);
     } else if (re[i] == ')') {
       int ind = info->brackets[info->num_brackets - 1].len == -1 ?
         info->num_brackets - 1 : depth;
@@ -2783,30 +2891,527 @@ private int re_foo (const char *re, int re_len, const char *s, int s_len,
   FAIL_IF(depth != 0, RE_UNBALANCED_BRACKETS_ERROR);
   re_setup_branch_points(info);
 
-  return re_baz (s, s_len, info);
+  return 0;
+}
+
+/* nfa:
+   the code generation and the simulation follow Russ Cox' articles at:
+   https://swtch.com/~rsc/regexp/
+   Atoms are matched with the same functions with slre, so the classes, the
+   escapes and the RE_IGNORE_CASE flag mean exactly the same thing. Unlike the
+   backtracker, the first alternative that leads to a match wins, as in Perl.
+ */
+
+private int re_nfa_emit (struct re_nfa *nfa, int op, int x, int y) {
+  struct re_nfa_inst *inst = &nfa->inst[nfa->num_inst];
+  inst->op = op;
+  inst->x = x;
+  inst->y = y;
+  inst->re = NULL;
+  inst->re_len = 0;
+  return nfa->num_inst++;
+}
+
+private int re_nfa_compile_alt (const char *, int, struct regex_info *,
+                                                     struct re_nfa *, int *);
+
+/* the following return NOTOK for what is left to the backtracker, that is
+ * non greedy quantifiers and anything that slre reports as an error while
+ * matching, like a misplaced quantifier or an unterminated set */
+private int re_nfa_compile_seq (const char *re, int re_len,
+                   struct regex_info *info, struct re_nfa *nfa, int *bi) {
+  int i, step, split, start;
+  char q;
+
+  for (i = 0; i < re_len; i += step) {
+    if (is_quantifier (re + i)) return NOTOK;
+
+    if (re[i] is '(') {
+      if (*bi + 1 >= info->num_brackets) return NOTOK;
+      step = info->brackets[*bi + 1].len + 2;
+    } else
+      step = re_get_op_len (re + i, re_len - i);
+
+    if (step <= 0 or i + step > re_len) return NOTOK;
+
+    q = 0;
+    if (i + step < re_len and is_quantifier (re + i + step)) {
+      q = re[i + step];
+      if (i + step + 1 < re_len and is_quantifier (re + i + step + 1))
+        return NOTOK;
+      if (re[i] is '^' or re[i] is '$') return NOTOK;
+    }
+
+    split = -1;
+    if (q is '*' or q is '?') split = re_nfa_emit (nfa, RE_NFA_SPLIT, 0, 0);
+    start = nfa->num_inst;
+
+    switch (re[i]) {
+      case '(': {
+        int b = ++(*bi);
+        re_nfa_emit (nfa, RE_NFA_SAVE, 2 * b, 0);
+        if (NOTOK is re_nfa_compile_alt (re + i + 1, step - 2, info, nfa, bi))
+          return NOTOK;
+        re_nfa_emit (nfa, RE_NFA_SAVE, 2 * b + 1, 0);
+        break;
+      }
+
+      case '[': {
+        int idx = re_nfa_emit (nfa, RE_NFA_SET, 0, 0);
+        nfa->inst[idx].re = re + i + 1;
+        nfa->inst[idx].re_len = step - 2;
+        break;
+      }
+
+      case '^': re_nfa_emit (nfa, RE_NFA_BOL, 0, 0); break;
+      case '$': re_nfa_emit (nfa, RE_NFA_EOL, 0, 0); break;
+
+      default: {
+        int idx = re_nfa_emit (nfa, RE_NFA_OP, 0, 0);
+        nfa->inst[idx].re = re + i;
+        nfa->inst[idx].re_len = step;
+      }
+    }
+
+    switch (q) {
+      case '*':
+        re_nfa_emit (nfa, RE_NFA_JMP, split, 0);
+        nfa->inst[split].x = start;
+        nfa->inst[split].y = nfa->num_inst;
+        break;
+
+      case '+':
+        re_nfa_emit (nfa, RE_NFA_SPLIT, start, nfa->num_inst + 1);
+        break;
+
+      case '?':
+        nfa->inst[split].x = start;
+        nfa->inst[split].y = nfa->num_inst;
+    }
+
+    if (q) step++;
+  }
+
+  return OK;
+}
+
+private int re_nfa_compile_alt (const char *re, int re_len,
+                   struct regex_info *info, struct re_nfa *nfa, int *bi) {
+  int i, step, depth = 0;
+
+  for (i = 0; i < re_len; i += step) {
+    step = re_get_op_len (re + i, re_len - i);
+    if (step <= 0) return NOTOK;
+
+    if (re[i] is '(') depth++;
+    else if (re[i] is ')') depth--;
+    else if (re[i] is '|' and depth is 0) break;
+  }
+
+  if (i >= re_len) return re_nfa_compile_seq (re, re_len, info, nfa, bi);
+
+  int split = re_nfa_emit (nfa, RE_NFA_SPLIT, nfa->num_inst + 1, 0);
+  if (NOTOK is re_nfa_compile_seq (re, i, info, nfa, bi)) return NOTOK;
+  int jmp = re_nfa_emit (nfa, RE_NFA_JMP, 0, 0);
+  nfa->inst[split].y = nfa->num_inst;
+  if (NOTOK is re_nfa_compile_alt (re + i + 1, re_len - i - 1, info, nfa, bi))
+    return NOTOK;
+  nfa->inst[jmp].x = nfa->num_inst;
+  return OK;
+}
+
+/* returns NOTOK if a match can start without consuming */
+private int re_nfa_compile_first (struct re_nfa *nfa, int pc, char *seen) {
+  if (seen[pc]) return OK;
+  seen[pc] = 1;
+
+  struct re_nfa_inst *inst = &nfa->inst[pc];
+
+  switch (inst->op) {
+    case RE_NFA_JMP:
+      return re_nfa_compile_first (nfa, inst->x, seen);
+
+    case RE_NFA_SPLIT:
+      if (NOTOK is re_nfa_compile_first (nfa, inst->x, seen)) return NOTOK;
+      return re_nfa_compile_first (nfa, inst->y, seen);
+
+    case RE_NFA_SAVE:
+      return re_nfa_compile_first (nfa, pc + 1, seen);
+
+    case RE_NFA_OP:
+    case RE_NFA_SET:
+      nfa->first[nfa->num_first++] = pc;
+      return OK;
+
+    default:
+      return NOTOK;
+  }
+}
+
+/* at most two instructions are emitted for every byte of the pattern, plus
+ * the first and the last save and the match */
+private void re_nfa_compile (struct regex_info *info) {
+  const char *re = info->brackets[0].ptr;
+  int re_len = info->brackets[0].len;
+  int bi = 0;
+
+  info->nfa = Alloc (sizeof (struct re_nfa));
+  info->nfa->inst = Alloc (sizeof (struct re_nfa_inst) * (size_t) (re_len * 2 + 3));
+  info->nfa->num_inst = 0;
+  info->nfa->num_slots = info->num_brackets * 2;
+  info->nfa->is_anchored = re_len > 0 and re[0] is '^' and
+      0 is info->brackets[0].num_branches;
+
+  re_nfa_emit (info->nfa, RE_NFA_SAVE, 0, 0);
+  if (NOTOK is re_nfa_compile_alt (re, re_len, info, info->nfa, &bi))
+    goto theerror;
+  re_nfa_emit (info->nfa, RE_NFA_SAVE, 1, 0);
+  re_nfa_emit (info->nfa, RE_NFA_MATCH, 0, 0);
+
+  if (info->nfa->num_inst * info->nfa->num_slots > RE_NFA_MAX_CELLS)
+    goto theerror;
+
+  info->nfa->first = Alloc (sizeof (int) * (size_t) info->nfa->num_inst);
+  {
+    char seen[info->nfa->num_inst];
+    memset (seen, 0, (size_t) info->nfa->num_inst);
+    if (NOTOK is re_nfa_compile_first (info->nfa, 0, seen))
+      info->nfa->num_first = 0;
+  }
+
+  return;
+
+theerror:
+  re_nfa_free (info);
+}
+
+/* adds a thread to the list, by following the instructions that do not
+ * consume, in the order of their priority; an instruction is added once
+ * for every position */
+private void re_nfa_add_thread (struct re_nfa *nfa, struct re_nfa_threads *list,
+                int *mark, int pc, int *caps, int sp, int s_len) {
+  if (mark[pc] is sp) return;
+  mark[pc] = sp;
+
+  struct re_nfa_inst *inst = &nfa->inst[pc];
+
+  switch (inst->op) {
+    case RE_NFA_JMP:
+      re_nfa_add_thread (nfa, list, mark, inst->x, caps, sp, s_len);
+      return;
+
+    case RE_NFA_SPLIT:
+      re_nfa_add_thread (nfa, list, mark, inst->x, caps, sp, s_len);
+      re_nfa_add_thread (nfa, list, mark, inst->y, caps, sp, s_len);
+      return;
+
+    case RE_NFA_BOL:
+      if (sp is nfa->bol) re_nfa_add_thread (nfa, list, mark, pc + 1, caps, sp, s_len);
+      return;
+
+    case RE_NFA_EOL:
+      if (sp is s_len) re_nfa_add_thread (nfa, list, mark, pc + 1, caps, sp, s_len);
+      return;
+
+    case RE_NFA_SAVE: {
+      int old = caps[inst->x];
+      caps[inst->x] = sp;
+      re_nfa_add_thread (nfa, list, mark, pc + 1, caps, sp, s_len);
+      caps[inst->x] = old;
+      return;
+    }
+
+    default:
+      list->pc[list->num] = pc;
+      memcpy (list->caps + list->num * nfa->num_slots, caps,
+          sizeof (int) * (size_t) nfa->num_slots);
+      list->num++;
+  }
+}
+
+/* the threads that start earlier come first in the list, so once a thread
+ * matches, the rest of the list and the new starts are dropped */
+private int re_nfa_match (const char *s, int s_len, struct regex_info *info) {
+  struct re_nfa *nfa = info->nfa;
+  int num_inst = nfa->num_inst;
+  int num_slots = nfa->num_slots;
+  int pc_a[num_inst], pc_b[num_inst], mark[num_inst];
+  int caps_a[num_inst * num_slots], caps_b[num_inst * num_slots];
+  int caps[num_slots], match[num_slots];
+  int matched = 0;
+
+  struct re_nfa_threads list_a = {0, pc_a, caps_a}, list_b = {0, pc_b, caps_b};
+  struct re_nfa_threads *clist = &list_a, *nlist = &list_b, *tmp;
+
+  for (int i = 0; i < num_inst; i++) mark[i] = -1;
+  nfa->bol = (info->flags & RE_NOTBOL) ? -1 : 0;
+
+  for (int sp = 0; sp <= s_len; sp++) {
+    /* without threads, skip to a byte that a match can start with */
+    if (0 is clist->num and nfa->num_first) {
+      if (matched or (sp and nfa->is_anchored)) break;
+
+      for (; sp < s_len; sp++) {
+        int i = 0;
+        for (; i < nfa->num_first; i++) {
+          struct re_nfa_inst *inst = &nfa->inst[nfa->first[i]];
+          if (0 < (inst->op is RE_NFA_OP
+              ? re_match_op ((const unsigned char *) inst->re,
+                             (const unsigned char *) s + sp, info)
+              : re_match_set (inst->re, inst->re_len, s + sp, info)))
+            break;
+        }
+
+        if (i < nfa->num_first) break;
+      }
+
+      if (sp is s_len) break;
+    }
+
+    if (0 is matched and (0 is sp or 0 is nfa->is_anchored)) {
+      for (int i = 0; i < num_slots; i++) caps[i] = -1;
+      re_nfa_add_thread (nfa, clist, mark, 0, caps, sp, s_len);
+    }
+
+    if (0 is clist->num) break;
+
+    nlist->num = 0;
+
+    for (int i = 0; i < clist->num; i++) {
+      struct re_nfa_inst *inst = &nfa->inst[clist->pc[i]];
+      int *tcaps = clist->caps + i * num_slots;
+
+      if (inst->op is RE_NFA_MATCH) {
+        memcpy (match, tcaps, sizeof (int) * (size_t) num_slots);
+        matched = 1;
+        break;
+      }
+
+      if (sp is s_len) continue;
+
+      int n = (inst->op is RE_NFA_OP
+        ? re_match_op ((const unsigned char *) inst->re,
+                       (const unsigned char *) s + sp, info)
+        : re_match_set (inst->re, inst->re_len, s + sp, info));
+
+      if (n <= 0) continue;
+
+      memcpy (caps, tcaps, sizeof (int) * (size_t) num_slots);
+      re_nfa_add_thread (nfa, nlist, mark, clist->pc[i] + 1, caps, sp + 1, s_len);
+    }
+
+    tmp = clist; clist = nlist; nlist = tmp;
+  }
+
+  ifnot (matched) return RE_NO_MATCH;
+
+  info->match_idx = match[0];
+  info->match_len = match[1] - match[0];
+
+  /* as with slre, only the captures that are not empty are set */
+  if (info->caps isnot NULL) {
+    for (int b = 1; b < info->num_brackets and b <= info->num_caps; b++) {
+      if (0 > match[2 * b] or 0 > match[2 * b + 1]) continue;
+      int len = match[2 * b + 1] - match[2 * b];
+      if (0 >= len) continue;
+      info->caps[b - 1].ptr = s + match[2 * b];
+      info->caps[b - 1].len = len;
+      info->total_caps = b;
+    }
+  }
+
+  return match[1];
+}
+
+/* literal:
+   the longest run of bytes that every match contains, is extracted from the
+   top level of a pattern without alternations (groups and optional bytes end
+   a run), so a line without it can be rejected before the machine runs */
+
+private void re_literal_set (struct regex_info *info, const char *lit, int len) {
+  /* the byte that is looked up should have at most two cases, so two
+   * memchr() can find it, when the case is ignored */
+  for (int i = 0; i < len; i++) {
+    unsigned char c = (unsigned char) lit[i];
+    int num = 0;
+    unsigned char other = c;
+
+    for (int b = 0; b < 256; b++)
+      if (ustring_to_lower (b) is ustring_to_lower (c)) {
+        num++;
+        if (b isnot c) other = (unsigned char) b;
+      }
+
+    if (num > 2) continue;
+
+    info->literal = Alloc ((size_t) len + 1);
+    memcpy (info->literal, lit, (size_t) len);
+    info->literal[len] = '\0';
+    info->literal_len = len;
+    info->literal_idx = i;
+    info->literal_byte[0] = c;
+    info->literal_byte[1] = other;
+    return;
+  }
+}
+
+private void re_compile_literal (struct regex_info *info) {
+  const char *re = info->brackets[0].ptr;
+  int re_len = info->brackets[0].len;
+
+  if (info->brackets[0].num_branches) return;
+
+  char run[re_len + 1], lit[re_len + 1];
+  int i, step, depth = 0, run_len = 0, lit_len = 0;
+
+  for (i = 0; i <= re_len; i += step) {
+    int c = -1;
+    int q = 0;
+    step = 1;
+
+    if (i < re_len) {
+      step = re_get_op_len (re + i, re_len - i);
+      if (step <= 0 or i + step > re_len) return;
+
+      if (i + step < re_len and is_quantifier (re + i + step))
+        q = re[i + step];
+
+      switch (re[i]) {
+        case '(': depth++; break;
+        case ')': depth--; break;
+        case '[': case '.': case '^': case '$': case '|':
+        case '*': case '+': case '?':
+          break;
+
+        case '\\':
+          switch (re[i + 1]) {
+            case 'S': case 's': case 'd': break;
+            case 'x': c = re_hextoi ((const unsigned char *) re + i + 2); break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'v': c = '\v'; break;
+            default: c = (unsigned char) re[i + 1];
+          }
+          break;
+
+        default:
+          c = (unsigned char) re[i];
+      }
+    }
+
+    if (depth is 0 and c isnot -1 and (q is 0 or q is '+')) {
+      run[run_len++] = (char) c;
+      if (q is 0) continue;
+    }
+
+    if (run_len > lit_len) {
+      memcpy (lit, run, (size_t) run_len);
+      lit_len = run_len;
+    }
+
+    run_len = 0;
+  }
+
+  if (lit_len) re_literal_set (info, lit, lit_len);
+}
+
+/* returns the first occurence of the literal in s or NULL; with
+ * RE_IGNORE_CASE the bytes are compared like slre does; the scan is left to
+ * memchr() and memcmp(), as a direct call to the C library was much faster
+ * than any search written by hand (see data/research/strstr_implementation.c) */
+private const char *re_literal_find (struct regex_info *info, const char *s,
+                                                      int s_len, int flags) {
+  const char *lit = info->literal;
+  int len = info->literal_len;
+  int idx = info->literal_idx;
+  int ignore_case = flags & RE_IGNORE_CASE;
+  int ba = info->literal_byte[0];
+  int bb = ignore_case ? info->literal_byte[1] : ba;
+
+  if (s_len < len) return NULL;
+
+  const char *sp = s + idx;
+  const char *end = s + s_len - len + idx + 1;
+  const char *pa = NULL, *pb = (ba is bb ? end : NULL);
+
+  while (sp < end) {
+    if (NULL is pa or pa < sp)
+      if (NULL is (pa = memchr (sp, ba, (size_t) (end - sp)))) pa = end;
+
+    if (NULL is pb or pb < sp)
+      if (NULL is (pb = memchr (sp, bb, (size_t) (end - sp)))) pb = end;
+
+    const char *p = (pa < pb ? pa : pb);
+    if (p is end) return NULL;
+
+    const char *m = p - idx;
+
+    ifnot (ignore_case) {
+      if (0 is memcmp (m, lit, (size_t) len)) return m;
+    } else {
+      int i = 0;
+      for (; i < len; i++)
+        if (ustring_to_lower ((unsigned char) m[i]) isnot
+            ustring_to_lower ((unsigned char) lit[i])) break;
+
+      if (i is len) return m;
+    }
+
+    sp = p + 1;
+  }
+
+  return NULL;
+}
+
+/* the pattern is parsed once, and its brackets and branches point to the
+ * bytes of the pattern, so they are released together */
+private void re_compile_prog (regexp_t *re) {
+  if (NULL is re->prog)
+    re->prog = Alloc (sizeof (struct regex_info));
+  else {
+    re_nfa_free (re->prog);
+    re_literal_free (re->prog);
+  }
+
+  re->prog->retval = re_foo (re->pat->bytes, (int) re->pat->num_bytes, re->prog);
+
+  if (0 is re->prog->retval) {
+    re_nfa_compile (re->prog);
+    re_compile_literal (re->prog);
+  }
 }
 
 /* this is like slre_match(), with an aditional argument and three extra fields
- * in the slre regex_info structure */
-private int re_match (regexp_t *re, const char *regexp, const char *s,
-             int s_len, struct re_cap *caps, int num_caps, int flags) {
-  struct regex_info info;
+ * in the slre regex_info structure, but the regex has been already parsed */
+private int re_match (regexp_t *re, const char *s, int s_len,
+                      struct re_cap *caps, int num_caps, int flags) {
+  struct regex_info *info = re->prog;
+
+  if (0 > info->retval) return info->retval;
+
+  if (num_caps > 0 && info->num_brackets - 1 > num_caps)
+    return RE_CAPS_ARRAY_TOO_SMALL_ERROR;
 
-  info.flags = flags;
-  info.num_brackets = info.num_branches = 0;
-  info.num_caps = num_caps;
-  info.caps = caps;
+  info->flags = flags;
+  info->bol = (flags & RE_NOTBOL) ? NULL : s;
+  info->num_caps = num_caps;
+  info->caps = caps;
 
-  info.match_idx = info.match_len = -1;
-  info.total_caps = 0;
+  info->match_idx = info->match_len = -1;
+  info->total_caps = 0;
 
-  int retval = re_foo (regexp, (int) bytelen(regexp), s, s_len, &info);
+  int retval = (NULL is info->nfa
+    ? re_baz (s, s_len, info)
+    : re_nfa_match (s, s_len, info));
 
   if (0 <= retval) {
-    re->match_idx = info.match_idx;
-    re->match_len = info.match_len;
-    re->total_caps = info.total_caps;
-    re->match_ptr = (char *) s + info.match_idx;
+    re->match_idx = info->match_idx;
+    re->match_len = info->match_len;
+    re->total_caps = info->total_caps;
+    re->match_ptr = (char *) s + info->match_idx;
   }
 
   return retval;
@@ -2818,6 +3423,7 @@ private int re_compile (regexp_t *re) {
     string_delete_numbytes_at (re->pat, 4, 0);
   }
 
+  re_compile_prog (re);
   return OK;
 }
 
@@ -2829,11 +3435,16 @@ private int re_exec (regexp_t *re, char *buf, size_t buf_len) {
       re->pat->bytes[0] is '|'))
     return re->retval;
 
+  if (NULL is re->prog) re_compile_prog (re);
+
+  if (re->prog->literal_len and
+      NULL is re_literal_find (re->prog, buf, (int) buf_len, re->flags))
+    return re->retval;
+
   do {
     struct re_cap cap[re->num_caps];
     for (int i = 0; i < re->num_caps; i++) cap[i].len = 0;
-    re->retval = re_match (re, re->pat->bytes, buf, buf_len,
-        cap, re->num_caps, re->flags);
+    re->retval = re_match (re, buf, buf_len, cap, re->num_caps, re->flags);
 
     if (re->retval is RE_CAPS_ARRAY_TOO_SMALL_ERROR) {
       re_free_captures (re);
@@ -2990,30 +3601,100 @@ private int file_is_elf (const char *file) {
   return retval;
 }
 
+private void fdlines_init (fdlines_t *this, int fd) {
+  *this = (fdlines_t) {.fd = fd, .bytes = NULL};
+}
+
+private void fdlines_release (fdlines_t *this) {
+  ifnot (NULL is this->bytes) free (this->bytes);
+  this->bytes = NULL;
+}
+
+/* returns the length of the next line including the new line character, as
+ * getline() does, or -1 at the end; the line is '\0' terminated, by replacing
+ * temporarily the first byte of the next line */
+private ssize_t fdlines_get (fdlines_t *this, char **line) {
+  if (this->saved_idx) {
+    this->bytes[this->saved_idx] = this->saved;
+    this->saved_idx = 0;
+  }
+
+  for (;;) {
+    char *sp = this->bytes + this->offset;
+    size_t avail = this->num_bytes - this->offset;
+    char *nl = NULL;
+
+    if (avail > this->scanned)
+      nl = memchr (sp + this->scanned, '\n', avail - this->scanned);
+
+    if (NULL isnot nl or this->is_eof) {
+      if (0 is avail) return -1;
+
+      size_t len = (NULL is nl ? avail : (size_t) (nl - sp) + 1);
+      this->offset += len;
+      this->scanned = 0;
+      this->saved_idx = this->offset;
+      this->saved = this->bytes[this->offset];
+      this->bytes[this->offset] = '\0';
+      *line = sp;
+      return len;
+    }
+
+    this->scanned = avail;
+
+    /* keep the partial line, and read more bytes after it, with one byte
+     * always available for the terminating '\0' */
+    if (this->offset) {
+      memmove (this->bytes, sp, avail);
+      this->num_bytes = avail;
+      this->offset = 0;
+    }
+
+    if (this->num_bytes >= this->mem_size / 2) {
+      this->mem_size = (this->mem_size ? this->mem_size * 2 : FDLINES_CHUNK_SIZE);
+      this->bytes = Realloc (this->bytes, this->mem_size);
+    }
+
+    ssize_t n = read (this->fd, this->bytes + this->num_bytes,
+        this->mem_size - this->num_bytes - 1);
+
+    if (NOTOK is n) {
+      if (errno is EINTR) continue;
+      n = 0;
+    }
+
+    ifnot (n) this->is_eof = 1;
+    this->num_bytes += n;
+  }
+}
+
 private Vstring_t *file_readlines (char *file, Vstring_t *lines,
                                  FileReadLines_cb cb, void *obj) {
   Vstring_t *llines = lines;
   if (NULL is llines) llines = vstring_new ();
   if (-1 is access (file, F_OK|R_OK)) goto theend;
-  FILE *fp = fopen (file, "r");
-  char *buf = NULL;
-  size_t len;
+  int fd = open (file, O_RDONLY);
+  if (NOTOK is fd) goto theend;
+
+  fdlines_t fdl;
+  fdlines_init (&fdl, fd);
+  char *buf;
   ssize_t nread;
 
   if (cb isnot NULL) {
     int num = 0;
-    while (-1 isnot (nread = getline (&buf, &len, fp))) {
+    while (-1 isnot (nread = fdlines_get (&fdl, &buf))) {
       cb (llines, buf, nread, ++num, obj);
     }
   } else {  /* by default an array of lines */
-    while (-1 isnot (nread = getline (&buf, &len, fp))) {
+    while (-1 isnot (nread = fdlines_get (&fdl, &buf))) {
       buf[nread - 1] = '\0';
       vstring_current_append_with (llines, buf);
     }
   }
 
-  fclose (fp);
-  ifnot (buf is NULL) free (buf);
+  close (fd);
+  fdlines_release (&fdl);
 
 theend:
   return llines;
@@ -3910,7 +4591,11 @@ private void term_unset_state_bit (term_t *this, int bit) {
   $my(state) &= ~(bit);
 }
 
+/* the modes are set with TCSAFLUSH, that discards the pending input, so the
+ * bytes that were read but not consumed are discarded too */
 private int term_set_mode (term_t *this, char mode) {
+  $my(in_idx) = $my(in_num_bytes) = 0;
+
   switch (mode) {
     case 'o': return term_orig_mode (this);
     case 's': return term_sane_mode (this);
@@ -3924,9 +4609,28 @@ private void term_set_name (term_t *this) {
   $my(name) = NULL;
 }
 
-private int term_set (term_t *this) {
-  if (NOTOK is term_set_mode (this, 'r')) return NOTOK;
-  term_cursor_get_ptr_pos (this, &$my(orig_curs_row_pos), &$my(orig_curs_col_pos));
+/* the callback is called while waiting for input, for as long as it returns
+ * non zero and there is no pending input */
+private void term_set_on_idle (term_t *this, TermOnIdle_cb cb, void *obj) {
+  $my(on_idle) = cb;
+  $my(on_idle_obj) = obj;
+}
+
+private int term_input_is_pending (term_t *this) {
+  if ($my(in_idx) < $my(in_num_bytes)) return 1;
+
+  struct timeval tv;
+  fd_set read_fd;
+  FD_ZERO(&read_fd);
+  FD_SET($my(in_fd), &read_fd);
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+  return 0 < select ($my(in_fd) + 1, &read_fd, NULL, NULL, &tv);
+}
+
+private int term_set (term_t *this) {
+  if (NOTOK is term_set_mode (this, 'r')) return NOTOK;
+  term_cursor_get_ptr_pos (this, &$my(orig_curs_row_pos), &$my(orig_curs_col_pos));
   term_init_size (this, &$my(num_rows), &$my(num_cols));
 
   ifnot ($my(state) & TERM_DONOT_SAVE_SCREEN)
@@ -3941,6 +4645,7 @@ private int term_set (term_t *this) {
 
 private int term_reset (term_t *this) {
   ifnot (this->is_initialized) return OK;
+  TERM_SEND_ESC_SEQ (TERM_BRACKETED_PASTE_OFF);
   term_set_mode (this, 's');
   term_cursor_set_ptr_pos (this, $my(orig_curs_row_pos), $my(orig_curs_col_pos));
 
@@ -3951,6 +4656,169 @@ private int term_reset (term_t *this) {
   return OK;
 }
 
+/* the bytes are read in chunks, as many as are available, and are consumed
+ * from the buffer of the terminal; when it is empty, the read waits for as
+ * long as the raw mode says (VTIME), so the timeout after an escape byte is
+ * the same, whether the sequence came in one chunk or not */
+private int term_input_fill (term_t *this) {
+  if ($my(in_idx) < $my(in_num_bytes))
+    return $my(in_num_bytes) - $my(in_idx);
+
+  $my(in_idx) = $my(in_num_bytes) = 0;
+
+  int fd = $my(in_fd);
+  ssize_t bts;
+  while (NOTOK is (bts = read (fd, $my(in_buf), TERM_INPUT_BUF_SIZE))) {
+    CONTINUE_ON_EXPECTED_ERRNO (fd);
+    return NOTOK;
+  }
+
+  $my(in_num_bytes) = bts;
+  return bts;
+}
+
+/* like read(): 1 when there is a byte, 0 when there wasn't any in time */
+private int term_input_get_byte (term_t *this, char *c) {
+  int n = term_input_fill (this);
+  if (0 >= n) return n;
+  *c = $my(in_buf)[$my(in_idx)++];
+  return 1;
+}
+
+/* a paste ends also after that many timeouts in a row (of VTIME each), when
+ * the sequence that ends it never comes */
+#define TERM_PASTE_MAX_TIMEOUTS 20
+
+/* reads the text of a bracketed paste up to the sequence that ends it, with
+ * the carriage returns as new lines */
+private int term_input_get_paste (term_t *this, string_t *paste) {
+  const char *endseq = "\033[201~";
+  int endseq_len = 6;
+  int matched = 0;
+  int prev = 0;
+  int timeouts = 0;
+  char c = 0;
+
+  for (;;) {
+    int n = term_input_get_byte (this, &c);
+    if (NOTOK is n) return NOTOK;
+    if (0 is n) {
+      if (++timeouts < TERM_PASTE_MAX_TIMEOUTS) continue;
+      string_append_with_len (paste, endseq, matched);
+      return OK;
+    }
+
+    timeouts = 0;
+
+    if (c is endseq[matched]) {
+      if (++matched is endseq_len) return OK;
+      continue;
+    }
+
+    if (matched) {
+      string_append_with_len (paste, endseq, matched);
+      matched = (c is endseq[0]);
+      if (matched) continue;
+    }
+
+    if (c is '\n' and prev is '\r') {
+      prev = '\n';
+      continue;
+    }
+
+    prev = c;
+    string_append_byte (paste, (c is '\r' ? '\n' : c));
+  }
+
+  return OK;
+}
+
+/* the escape sequences (without the escape byte) that are known, for xterm,
+ * rxvt-unicode, st and linux terminals */
+static struct term_key_seq {
+  const char *seq;
+  utf8 key;
+} TERM_KEY_SEQS[] = {
+  {"[A", ARROW_UP_KEY},     {"[B", ARROW_DOWN_KEY},
+  {"[C", ARROW_RIGHT_KEY},  {"[D", ARROW_LEFT_KEY},
+  {"[H", HOME_KEY},         {"[F", END_KEY},
+  {"[P", DELETE_KEY},       {"[4h", INSERT_KEY},
+  {"[1~", HOME_KEY},        {"[2~", INSERT_KEY},
+  {"[3~", DELETE_KEY},      {"[4~", END_KEY},
+  {"[5~", PAGE_UP_KEY},     {"[6~", PAGE_DOWN_KEY},
+  {"[7~", HOME_KEY},        {"[8~", END_KEY},
+  {"[11~", FN_KEY(1)},      {"[12~", FN_KEY(2)},
+  {"[13~", FN_KEY(3)},      {"[14~", FN_KEY(4)},
+  {"[15~", FN_KEY(5)},      {"[17~", FN_KEY(6)},
+  {"[18~", FN_KEY(7)},      {"[19~", FN_KEY(8)},
+  {"[20~", FN_KEY(9)},      {"[21~", FN_KEY(10)},
+  {"[23~", FN_KEY(11)},     {"[24~", FN_KEY(12)},
+  {"[[A", FN_KEY(1)},       {"[[B", FN_KEY(2)},
+  {"[[C", FN_KEY(3)},       {"[[D", FN_KEY(4)},
+  {"[[E", FN_KEY(5)},
+  {"[200~", BRACKETED_PASTE_KEY},
+  {"OA", ARROW_UP_KEY},     {"OB", ARROW_DOWN_KEY},
+  {"OC", ARROW_RIGHT_KEY},  {"OD", ARROW_LEFT_KEY},
+  {"OH", HOME_KEY},         {"OF", END_KEY},
+  {"OP", FN_KEY(1)},        {"OQ", FN_KEY(2)},
+  {"OR", FN_KEY(3)},        {"OS", FN_KEY(4)},
+};
+
+#define TERM_ESC_SEQ_MAXLEN 16
+
+enum {
+  ESC_SEQ_INTRO,   /* after the escape byte */
+  ESC_SEQ_CSI,     /* after '[', until a final byte */
+  ESC_SEQ_LINUX,   /* after "[[", one more byte */
+  ESC_SEQ_SS3,     /* after 'O', one more byte */
+  ESC_SEQ_END
+};
+
+/* reads the rest of a sequence, and returns the key it is mapped to, 0 for
+ * unknown sequences (and for alt with a letter), or ESCAPE_KEY when the rest
+ * didn't come in time */
+private utf8 term_input_get_esc_seq (term_t *this) {
+  char seq[TERM_ESC_SEQ_MAXLEN];
+  int len = 0;
+  int state = ESC_SEQ_INTRO;
+  char c = 0;
+
+  while (state isnot ESC_SEQ_END) {
+    int n = term_input_get_byte (this, &c);
+    if (NOTOK is n) return NOTOK;
+    if (0 is n) return ESCAPE_KEY;
+
+    switch (state) {
+      case ESC_SEQ_INTRO:
+        if (c is ESCAPE_KEY) continue; /* probably alt->arrow-key */
+        if (c is '[') state = ESC_SEQ_CSI;
+        else if (c is 'O') state = ESC_SEQ_SS3;
+        else return 0;
+        break;
+
+      case ESC_SEQ_CSI:
+        if (len is 1 and c is '[') { state = ESC_SEQ_LINUX; break; }
+        if (c >= 0x40 and c <= 0x7e) state = ESC_SEQ_END;
+        else if (c < 0x20 or c > 0x3f) return 0;
+        break;
+
+      default:
+        state = ESC_SEQ_END;
+    }
+
+    if (len is TERM_ESC_SEQ_MAXLEN - 1) return 0;
+    seq[len++] = c;
+  }
+
+  seq[len] = '\0';
+
+  for (size_t i = 0; i < ARRLEN (TERM_KEY_SEQS); i++)
+    if (cstring_eq (TERM_KEY_SEQS[i].seq, seq))
+      return TERM_KEY_SEQS[i].key;
+
+  return 0;
+}
+
 /* This is an extended version of the same function of the kilo editor at:
  * https://github.com/antirez/kilo.git
  *
@@ -3958,163 +4826,54 @@ private int term_reset (term_t *this) {
  * It also handles UTF8 byte sequences and it should return the integer represantation
  * of such sequence */
 private utf8 term_input_get (term_t *this) {
-  char c;
+  char c = 0;
   int n;
-  char buf[5];
+  int is_idle = 1;
+
+  for (;;) {
+    if (is_idle and NULL isnot $my(on_idle) and 0 is term_input_is_pending (this)) {
+      is_idle = $my(on_idle) (this, $my(on_idle_obj));
+      continue;
+    }
 
-  while (0 is (n = fd_read ($my(in_fd), buf, 1)));
+    if (0 isnot (n = term_input_get_byte (this, &c))) break;
+    is_idle = 1;
+  }
 
   if (n is NOTOK) return NOTOK;
 
-  c = buf[0];
-
-  switch (c) {
-    case ESCAPE_KEY:
-      ifnot (fd_read ($my(in_fd), buf, 1))
-        return ESCAPE_KEY;
-
-      /* recent (revailed through CTRL-[other than CTRL sequence]) and unused */
-      if ('z' >= buf[0] and buf[0] >= 'a')
-        return 0;
-
-      if (buf[0] is ESCAPE_KEY /* probably alt->arrow-key */)
-        ifnot (fd_read ($my(in_fd), buf, 1))
-          return 0;
-
-      if (buf[0] isnot '[' and buf[0] isnot 'O')
-        return 0;
-
-      ifnot (fd_read ($my(in_fd), buf + 1, 1))
-        return ESCAPE_KEY;
-
-      if (buf[0] is '[') {
-        if ('0' <= buf[1] and buf[1] <= '9') {
-          ifnot (fd_read ($my(in_fd), buf + 2, 1))
-            return ESCAPE_KEY;
-
-          if (buf[2] is '~') {
-            switch (buf[1]) {
-              case '1': return HOME_KEY;
-              case '2': return INSERT_KEY;
-              case '3': return DELETE_KEY;
-              case '4': return END_KEY;
-              case '5': return PAGE_UP_KEY;
-              case '6': return PAGE_DOWN_KEY;
-              case '7': return HOME_KEY;
-              case '8': return END_KEY;
-              default: return 0;
-            }
-          } else if (buf[1] is '1') {
-            if (fd_read ($my(in_fd), buf, 1) is 0)
-              return ESCAPE_KEY;
-
-            switch (buf[2]) {
-              case '1': return FN_KEY(1);
-              case '2': return FN_KEY(2);
-              case '3': return FN_KEY(3);
-              case '4': return FN_KEY(4);
-              case '5': return FN_KEY(5);
-              case '7': return FN_KEY(6);
-              case '8': return FN_KEY(7);
-              case '9': return FN_KEY(8);
-              default: return 0;
-            }
-          } else if (buf[1] is '2') {
-            if (fd_read ($my(in_fd), buf, 1) is 0)
-              return ESCAPE_KEY;
-
-            switch (buf[2]) {
-              case '0': return FN_KEY(9);
-              case '1': return FN_KEY(10);
-              case '3': return FN_KEY(11);
-              case '4': return FN_KEY(12);
-              default: return 0;
-            }
-          } else { /* CTRL_[key other than CTRL sequence] */
-                   /* lower case */
-            if (buf[2] is 'h')
-              return INSERT_KEY; /* sample/test (logically return 0) */
-            else
-              return 0;
-          }
-        } else if (buf[1] is '[') {
-          if (fd_read ($my(in_fd), buf, 1) is 0)
-            return ESCAPE_KEY;
-
-          switch (buf[0]) {
-            case 'A': return FN_KEY(1);
-            case 'B': return FN_KEY(2);
-            case 'C': return FN_KEY(3);
-            case 'D': return FN_KEY(4);
-            case 'E': return FN_KEY(5);
-
-            default: return 0;
-          }
-        } else {
-          switch (buf[1]) {
-            case 'A': return ARROW_UP_KEY;
-            case 'B': return ARROW_DOWN_KEY;
-            case 'C': return ARROW_RIGHT_KEY;
-            case 'D': return ARROW_LEFT_KEY;
-            case 'H': return HOME_KEY;
-            case 'F': return END_KEY;
-            case 'P': return DELETE_KEY;
-
-            default: return 0;
-          }
-        }
-      } else if (buf[0] is 'O') {
-        switch (buf[1]) {
-          case 'A': return ARROW_UP_KEY;
-          case 'B': return ARROW_DOWN_KEY;
-          case 'C': return ARROW_RIGHT_KEY;
-          case 'D': return ARROW_LEFT_KEY;
-          case 'H': return HOME_KEY;
-          case 'F': return END_KEY;
-          case 'P': return FN_KEY(1);
-          case 'Q': return FN_KEY(2);
-          case 'R': return FN_KEY(3);
-          case 'S': return FN_KEY(4);
-
-          default: return 0;
-        }
-      }
-    break;
+  if (c is ESCAPE_KEY) return term_input_get_esc_seq (this);
 
-  default:
-    if (c < 0) {
-      int len = ustring_charlen ((uchar) c);
-      utf8 code = 0;
-      code += (uchar) c;
+  if (c < 0) {
+    int len = ustring_charlen ((uchar) c);
+    utf8 code = 0;
+    code += (uchar) c;
 
-      int idx;
-      int invalid = 0;
-      char cc;
+    int idx;
+    int invalid = 0;
+    char cc;
 
-      for (idx = 0; idx < len - 1; idx++) {
-        if (0 >= fd_read ($my(in_fd), &cc, 1))
-          return NOTOK;
+    for (idx = 0; idx < len - 1; idx++) {
+      if (0 >= term_input_get_byte (this, &cc))
+        return NOTOK;
 
-        if (isnotutf8 ((uchar) cc)) {
-          invalid = 1;
-        } else {
-          code <<= 6;
-          code += (uchar) cc;
-        }
+      if (isnotutf8 ((uchar) cc)) {
+        invalid = 1;
+      } else {
+        code <<= 6;
+        code += (uchar) cc;
       }
-
-      if (invalid) return NOTOK;
-
-      code -= offsetsFromUTF8[len-1];
-      return code;
     }
 
-    if (127 is c) return BACKSPACE_KEY;
+    if (invalid) return NOTOK;
 
-    return c;
+    code -= offsetsFromUTF8[len-1];
+    return code;
   }
 
-  return NOTOK;
+  if (127 is c) return BACKSPACE_KEY;
+
+  return c;
 }
 
 private void video_alloc_list (video_t *this) {
@@ -4145,6 +4904,11 @@ private video_t *video_new (int fd, int rows, int cols, int first_row, int first
   this->render = string_new (cols);
   this->tmp_render = string_new (cols);
   this->rows = Alloc (sizeof (int) * this->num_rows);
+  this->frame = Alloc (sizeof (string_t *) * this->num_rows);
+  this->frame_is_valid = Alloc (sizeof (int) * this->num_rows);
+  for (int i = 0; i < this->num_rows; i++)
+    this->frame[i] = string_new (cols);
+
   video_alloc_list (this);
   return this;
 }
@@ -4162,8 +4926,13 @@ private void video_free (video_t *this) {
     it = next;
   }
 
+  for (int i = 0; i < this->num_rows; i++)
+    string_free (this->frame[i]);
+
   string_free (this->render);
   string_free (this->tmp_render);
+  free (this->frame);
+  free (this->frame_is_valid);
   free (this->rows);
   free (this);
   this = NULL;
@@ -4173,15 +4942,183 @@ private void video_flush (video_t *this, string_t *render) {
   fd_write (this->fd, render->bytes, render->num_bytes);
 }
 
+/* rows are 1-based as in the draw functions */
+private void video_frame_invalidate (video_t *this, int frow, int lrow) {
+  if (NULL is this) return;
+  if (frow < 1) frow = 1;
+  if (lrow > this->num_rows) lrow = this->num_rows;
+  for (int i = frow - 1; i < lrow; i++) this->frame_is_valid[i] = 0;
+}
+
+private void video_frame_set (video_t *this, int idx, string_t *data) {
+  if (idx < 0 or idx >= this->num_rows) return;
+  string_replace_with_len (this->frame[idx], data->bytes, data->num_bytes);
+  this->frame_is_valid[idx] = 1;
+}
+
+/* the common prefix of two rows, as long as it consists of plain ascii bytes
+ * and color sequences; returns its length, and sets the columns it occupies */
+private size_t video_row_common_prefix (string_t *a, string_t *b, int *num_cols) {
+  size_t len = (a->num_bytes < b->num_bytes ? a->num_bytes : b->num_bytes);
+  size_t idx = 0;
+  *num_cols = 0;
+
+  while (idx < len and a->bytes[idx] is b->bytes[idx]) {
+    if (a->bytes[idx] is '\033') {
+      size_t i = idx + 1;
+      if (i >= len or a->bytes[i] isnot '[' or b->bytes[i] isnot '[') break;
+      i++;
+      while (i < len and a->bytes[i] is b->bytes[i] and
+          (IS_DIGIT (a->bytes[i]) or a->bytes[i] is ';')) i++;
+      if (i >= len or a->bytes[i] isnot 'm' or b->bytes[i] isnot 'm') break;
+      idx = i + 1;
+      continue;
+    }
+
+    if (' ' > a->bytes[idx] or a->bytes[idx] > '~') break;
+    idx++;
+    (*num_cols)++;
+  }
+
+  return idx;
+}
+
+private int video_frame_is_eq (video_t *this, int idx, string_t *data) {
+  if (0 is this->frame_is_valid[idx]) return 0;
+  string_t *frame = this->frame[idx];
+  return data->num_bytes is frame->num_bytes and
+      0 is memcmp (data->bytes, frame->bytes, data->num_bytes);
+}
+
+/* the number of rows in [fidx, lidx] that are in the frame, after moving
+ * it num rows (up when positive) */
+private int video_frame_num_eq (video_t *this, string_t **data, int fidx,
+                                                       int lidx, int num) {
+  int num_eq = 0;
+  for (int i = fidx; i <= lidx; i++) {
+    int j = i + num;
+    if (j < fidx or j > lidx) continue;
+    num_eq += video_frame_is_eq (this, j, data[i - fidx]);
+  }
+  return num_eq;
+}
+
+/* when the new rows are the rows of the frame moved up or down, the terminal
+ * moves them (by deleting or inserting lines into a scroll region), so only
+ * the rows that came into view have to be written afterwards */
+private void video_scroll_frame (video_t *this, int frow, int lrow) {
+  int fidx = frow - 1; int lidx = lrow - 1;
+  int num_rows = lrow - frow + 1;
+  if (num_rows < 3 or this->first_col isnot 1) return;
+
+  string_t *data[num_rows];
+  if (current_list_set (this, fidx) is INDEX_ERROR) return;
+  vstring_t *it = this->current;
+  for (int i = 0; i < num_rows; i++) {
+    if (NULL is it) return;
+    data[i] = it->data;
+    it = it->next;
+  }
+
+  int num_eq = video_frame_num_eq (this, data, fidx, lidx, 0);
+  if (num_eq is num_rows) return;
+
+  int num = 0;
+  int max_eq = num_eq + 1;
+
+  for (int i = fidx + 1; i <= lidx; i++) {
+    if (video_frame_is_eq (this, i, data[0])) {
+      int n = video_frame_num_eq (this, data, fidx, lidx, i - fidx);
+      if (n > max_eq) { max_eq = n; num = i - fidx; }
+    }
+
+    if (video_frame_is_eq (this, fidx, data[i - fidx])) {
+      int n = video_frame_num_eq (this, data, fidx, lidx, fidx - i);
+      if (n > max_eq) { max_eq = n; num = fidx - i; }
+    }
+  }
+
+  ifnot (num) return;
+
+  int count = (num > 0 ? num : -num);
+
+  string_append_fmt (this->render, "%s%s" TERM_SCROLL_REGION_FMT TERM_GOTO_PTR_POS_FMT,
+      TERM_CURSOR_HIDE, TERM_COLOR_RESET, frow, lrow, frow, 1);
+
+  if (num > 0)
+    string_append_fmt (this->render, TERM_DELETE_LINE_FMT, count);
+  else
+    string_append_fmt (this->render, TERM_INSERT_LINE_FMT, count);
+
+  string_append_fmt (this->render, TERM_SCROLL_REGION_FMT, 0, this->num_rows);
+
+  string_t *moved[count];
+  if (num > 0) {
+    for (int i = 0; i < count; i++) moved[i] = this->frame[fidx + i];
+    for (int i = fidx; i <= lidx - count; i++) {
+      this->frame[i] = this->frame[i + count];
+      this->frame_is_valid[i] = this->frame_is_valid[i + count];
+    }
+
+    for (int i = 0; i < count; i++) {
+      this->frame[lidx - count + 1 + i] = moved[i];
+      this->frame_is_valid[lidx - count + 1 + i] = 0;
+    }
+  } else {
+    for (int i = 0; i < count; i++) moved[i] = this->frame[lidx - count + 1 + i];
+    for (int i = lidx; i >= fidx + count; i--) {
+      this->frame[i] = this->frame[i - count];
+      this->frame_is_valid[i] = this->frame_is_valid[i - count];
+    }
+
+    for (int i = 0; i < count; i++) {
+      this->frame[fidx + i] = moved[i];
+      this->frame_is_valid[fidx + i] = 0;
+    }
+  }
+}
+
+/* the rows that are the same with the frame are skipped, and those that start
+ * the same, are written from the first changed column, after the colors that
+ * were set until then */
 private void video_render_set_from_to (video_t *this, int frow, int lrow) {
   int fidx = frow - 1; int lidx = lrow - 1;
 
   string_append (this->render, TERM_CURSOR_HIDE);
   while (fidx <= lidx) {
-    current_list_set (this, fidx++);
+    if (current_list_set (this, fidx++) is INDEX_ERROR) break;
+    string_t *data = this->current->data;
+    string_t *frame = this->frame[this->cur_idx];
+
+    if (this->frame_is_valid[this->cur_idx]) {
+      if (data->num_bytes is frame->num_bytes and
+          0 is memcmp (data->bytes, frame->bytes, data->num_bytes))
+        continue;
+
+      int num_cols;
+      size_t len = video_row_common_prefix (data, frame, &num_cols);
+
+      if (num_cols) {
+        string_append_fmt (this->render, TERM_GOTO_PTR_POS_FMT "%s",
+            this->cur_idx + 1, this->first_col + num_cols, TERM_CLR_TO_EOL);
+
+        for (size_t i = 0; i < len; i++) {
+          if (data->bytes[i] isnot '\033') continue;
+          size_t beg = i;
+          while (data->bytes[i] isnot 'm') i++;
+          string_append_with_len (this->render, data->bytes + beg, i - beg + 1);
+        }
+
+        string_append_with_len (this->render, data->bytes + len, data->num_bytes - len);
+        video_frame_set (this, this->cur_idx, data);
+        continue;
+      }
+    }
+
     string_append_fmt (this->render, TERM_GOTO_PTR_POS_FMT "%s%s%s",
         this->cur_idx + 1, this->first_col, TERM_LINE_CLR_EOL,
-        this->current->data->bytes, TERM_NEXT_BOL);
+        data->bytes, TERM_NEXT_BOL);
+    video_frame_set (this, this->cur_idx, data);
   }
 
   string_append (this->render, TERM_CURSOR_SHOW);
@@ -4198,6 +5135,7 @@ private void video_draw_row_at (video_t *this, int at) {
       TERM_CURSOR_HIDE, at, this->first_col, TERM_LINE_CLR_EOL,
       row->data->bytes, TERM_CURSOR_SHOW, this->row_pos, this->col_pos);
 
+  video_frame_set (this, idx, row->data);
   video_flush (this, this->tmp_render);
 }
 
@@ -4210,9 +5148,11 @@ private void video_draw_all (video_t *this) {
   int num_times = this->last_row;
   vstring_t *row = this->head;
 
+  int idx = 0;
   loop (num_times - 1) {
     string_append_fmt (this->tmp_render, "%s%s%s", TERM_LINE_CLR_EOL,
         row->data->bytes, TERM_NEXT_BOL);
+    video_frame_set (this, idx++, row->data);
     row = row->next;
   }
 
@@ -4240,6 +5180,7 @@ private void video_row_hl_at (video_t *this, int idx, int color,
   string_replace_with_fmt (this->tmp_render, TERM_GOTO_PTR_POS_FMT, idx + 1, 1);
   string_append_with_len (this->tmp_render, row->data->bytes, row->data->num_bytes);
 
+  video_frame_invalidate (this, idx + 1, idx + 1);
   video_flush (this, this->tmp_render);
 }
 
@@ -4310,6 +5251,7 @@ private video_t *video_paint_rows_with (video_t *this, int row, int f_col, int l
   }
 
   this->rows[num_rows] = 0;
+  video_frame_invalidate (this, first_row, first_row + num_rows - 1);
 
   string_append_fmt (this->tmp_render, "%s%s", TERM_COLOR_RESET, TERM_CURSOR_SHOW);
   video_flush (this, this->tmp_render);
@@ -4325,6 +5267,7 @@ private term_T __init_term__ (void) {
       .reset = term_reset,
       .set_mode = term_set_mode,
       .set_name = term_set_name,
+      .set_on_idle = term_set_on_idle,
       .init_size = term_init_size,
       .set_state_bit = term_set_state_bit,
       .unset_state_bit = term_unset_state_bit,
@@ -4599,6 +5542,7 @@ init_list:;
 
 //    string_append (render, TERM_CURSOR_SHOW);
 
+    video_frame_invalidate (menu->cur_video, 1, menu->cur_video->num_rows);
     fd_write (menu->fd, render->bytes, render->num_bytes);
 
     String.free (render);
@@ -4920,8 +5864,10 @@ private ustring_t *buf_get_line_nth (Ustring_t *line, int idx) {
 }
 
 private ustring_t *buf_get_line_idx (Ustring_t *line, int idx) {
-  int cidx = current_list_set (line, idx);
-  if (cidx is INDEX_ERROR) return NULL;
+  if (0 > idx) idx += line->num_items;
+  if (idx < 0 or idx >= line->num_items) return NULL;
+  line->cur_idx = idx;
+  line->current = &line->nodes[idx];
   return line->current;
 }
 
@@ -4979,9 +5925,9 @@ private void buf_adjust_marks (buf_t *this, int type, int fidx, int lidx) {
     else
       mark->cur_idx += lcount;
 
-    while (idx++ < mark->cur_idx) {
-      mark->video_first_row_idx++;
-      mark->video_first_row = mark->video_first_row->next;
+    if (idx < mark->cur_idx) {
+      mark->video_first_row_idx = mark->cur_idx;
+      mark->video_first_row = self(get.row.at, mark->cur_idx);
     }
 
     mark->row_pos = $my(dim)->first_row;
@@ -5113,123 +6059,517 @@ private void buf_undo_clear (buf_t *this) {
   __buf_redo_clear__ (this);
 }
 
-private void buf_undo_push (buf_t *this, Action_t *action) {
-  if ($my(undo)->num_items > $myroots(max_num_undo_entries)) {
-    Action_t *tmp = list_pop_tail ($my(undo), Action_t);
-    self(Action.free, tmp);
-  }
-
-  ifnot ($my(undo)->state & VUNDO_RESET)
-    __buf_redo_clear__ (this);
-  else
-    $my(undo)->state &= ~VUNDO_RESET;
+/* the minimum number of the slots; the cache holds at least four pages, as the
+ * idle pass renders the page above and the page below the window */
+#define BUF_RENDER_CACHE_NUM_SLOTS 256
 
-  current_list_prepend ($my(undo), action);
+/* the number of the rows can change without anyone telling (as when the mapped
+ * lines are turned to rows); a state that is kept for *num_items rows, is
+ * updated to the current number, that is also returned as the index from
+ * which the state is not valid, or -1 when it has not changed */
+private int buf_num_items_sync (buf_t *this, int *num_items) {
+  if (*num_items is this->num_items) return -1;
+  *num_items = this->num_items;
+  return this->num_items;
 }
 
-private void buf_redo_push (buf_t *this, Action_t *action) {
-  if ($my(redo)->num_items > $myroots(max_num_undo_entries)) {
-    Action_t *tmp = list_pop_tail ($my(redo), Action_t);
-    self(Action.free, tmp);
-  }
+/* whether the rows end in an open multiline comment, is computed once for
+ * every row, from the first row that has been changed since then, up to the
+ * rows that are drawn; the rows that are inserted or deleted and the changes
+ * that are pushed to the undo list, invalidate the rows that follow them, while
+ * the current row, which is edited in place, is always checked */
+private void buf_syn_state_invalidate (buf_t *this, int idx) {
+  if (idx < $my(synstate).num_valid)
+    $my(synstate).num_valid = (idx < 0 ? 0 : idx);
+}
 
-  current_list_prepend ($my(redo), action);
+private void buf_syn_state_free (buf_t *this) {
+  ifnot (NULL is $my(synstate).in_mlcmnt) free ($my(synstate).in_mlcmnt);
+  $my(synstate).in_mlcmnt = NULL;
+  $my(synstate).mem_size = $my(synstate).num_valid = 0;
 }
 
-private int buf_undo_insert (buf_t *this, Action_t *redoact, action_t *act) {
-  ifnot (this->num_items) return DONE;
+/* the matches of the rows from idx on, are computed again when needed (see
+ * buf_match_compute()) */
+private void buf_match_invalidate (buf_t *this, int idx) {
+  bufmatch_t *bm = &$my(matches);
+  if (idx < 0) idx = 0;
+  if (idx < bm->num_valid) {
+    bm->num_valid = idx;
+    bm->num_matches = bm->row_start[idx];
+  }
+}
+
+private void buf_match_free (buf_t *this) {
+  bufmatch_t *bm = &$my(matches);
+  ifnot (NULL is bm->re) Re.free (bm->re);
+  String.free (bm->pat);
+  String.free (bm->render);
+  ifnot (NULL is bm->row_start) free (bm->row_start);
+  ifnot (NULL is bm->rows) free (bm->rows);
+  ifnot (NULL is bm->cols) free (bm->cols);
+  ifnot (NULL is bm->lens) free (bm->lens);
+  ifnot (NULL is bm->row_cols) free (bm->row_cols);
+  ifnot (NULL is bm->row_lens) free (bm->row_lens);
+  *bm = (bufmatch_t) {.re = NULL};
+}
+
+/* the parser recognizes only the first start token of the line, when it is
+ * at the beginning or after a space, and not after a single line comment */
+private int buf_syn_state_at_end (buf_t *this, row_t *row, int in_mlcmnt) {
+  char *bytes = row->data->bytes;
+  char *sp = bytes;
 
-  action_t *ract = self(action.new);
-  self(current.set, act->idx);
-  self(adjust.view);
-  ract->type = DELETE_LINE;
-  undo_set (ract, DELETE_LINE);
-  ract->idx = this->cur_idx;
-  ract->bytes = Cstring.dup ($mycur(data)->bytes, $mycur(data)->num_bytes);
-  stack_push (redoact, ract);
+  if (in_mlcmnt) {
+    sp = strstr (bytes, $my(syn)->multiline_comment_end);
+    if (NULL is sp) return 1;
+    sp += bytelen ($my(syn)->multiline_comment_end);
+  }
 
-  self(current.delete);
+  char *mp = strstr (bytes, $my(syn)->multiline_comment_start);
+  if (NULL is mp or mp < sp) return 0;
+  if (mp > bytes and mp[-1] isnot ' ' and mp[-1] isnot '\t') return 0;
 
-  if (this->num_items) {
-    self(current.set, act->cur_idx);
-    self(adjust.marks, DELETE_LINE, act->idx, act->idx);
-    undo_restore (act);
+  ifnot (NULL is $my(syn)->singleline_comment) {
+    char *cp = strstr (sp, $my(syn)->singleline_comment);
+    if (NULL isnot cp and cp < mp and
+        (cp is bytes or cp[-1] is ' ' or cp[-1] is '\t'))
+      return 0;
   }
 
-  return DONE;
+  return NULL is strstr (mp + bytelen ($my(syn)->multiline_comment_start),
+      $my(syn)->multiline_comment_end);
 }
 
-private int buf_undo_delete_line (buf_t *this, Action_t *redoact, action_t *act) {
-  action_t *ract = self(action.new);
-  row_t *row = self(row.new_with, act->bytes);
-  if (this->num_items) {
-    if (act->idx >= this->num_items) {
-      self(current.set, this->num_items - 1);
-      self(adjust.view);
-      undo_set (ract, INSERT_LINE);
-      self(current.append, row);
-      ract->idx = this->cur_idx;
-    } else {
-      self(current.set, act->idx);
-      self(adjust.view);
-      undo_set (ract, INSERT_LINE);
-      self(current.prepend, row);
-      ract->idx = this->cur_idx;
-    }
-    stack_push (redoact, ract);
-    self(adjust.marks, INSERT_LINE, act->idx, act->idx + 1);
-    undo_restore (act);
-  } else {
-    this->head = row;
-    this->tail = row;
-    this->cur_idx = 0;
-    this->current = this->head;
-    this->num_items = 1;
-    self(adjust.view);
-    undo_set (ract, INSERT_LINE);
-    stack_push (redoact, ract);
-    //  $my(video_first_row_idx) = this->cur_idx;
-    //  self(current.append, row);
+/* whether the row at idx starts in an open multiline comment */
+private int buf_syn_has_mlcmnt (buf_t *this, row_t *row, int idx) {
+  if (NULL is $my(syn)->multiline_comment_start or
+      NULL is $my(syn)->multiline_comment_end)
+    return 0;
+
+  synstate_t *st = &$my(synstate);
+
+  if (st->syn isnot $my(syn)) {
+    st->syn = $my(syn);
+    st->num_valid = 0;
   }
 
-  if ($my(video_first_row_idx) is this->cur_idx)
-    $my(video_first_row) = this->current;
+  int from = buf_num_items_sync (this, &st->num_items);
+  if (-1 isnot from) buf_syn_state_invalidate (this, from);
 
-  return DONE;
-}
+  if (st->mem_size < this->num_items) {
+    int mem_size = this->num_items + (this->num_items / 2) + 64;
+    st->in_mlcmnt = Realloc (st->in_mlcmnt, sizeof (uchar) * mem_size);
+    memset (st->in_mlcmnt + st->mem_size, 0, mem_size - st->mem_size);
+    st->mem_size = mem_size;
+  }
 
-private int buf_undo_replace_line (buf_t *this, Action_t *redoact, action_t *act) {
-  self(current.set, act->idx);
+  if (idx <= 0 or idx >= this->num_items) return 0;
 
-  action_t *ract = self(action.new);
-  self(set.row.idx, act->idx, act->row_pos - $my(dim)->first_row, act->col_pos);
-  undo_set (ract, REPLACE_LINE);
-  ract->idx = this->cur_idx;
-  ract->bytes = Cstring.dup ($mycur(data)->bytes, $mycur(data)->num_bytes);
-  stack_push (redoact, ract);
+  int cur_idx = this->cur_idx;
+  if (cur_idx < idx and cur_idx < st->num_valid and
+      st->in_mlcmnt[cur_idx] isnot buf_syn_state_at_end (this, this->current,
+          (cur_idx > 0 ? st->in_mlcmnt[cur_idx - 1] : 0)))
+    st->num_valid = cur_idx;
 
-  String.replace_with ($mycur(data), act->bytes);
+  if (idx <= st->num_valid) return st->in_mlcmnt[idx - 1];
 
-  undo_restore (act);
-  return DONE;
+  int i = st->num_valid;
+  row_t *it = row;
+  for (int n = idx - i; n and it; n--) it = it->prev;
+  if (NULL is it) it = self(get.row.at, i);
+
+  for (; i < idx and it; i++, it = it->next)
+    st->in_mlcmnt[i] = buf_syn_state_at_end (this, it,
+        (i > 0 ? st->in_mlcmnt[i - 1] : 0));
+
+  st->num_valid = i;
+  return st->in_mlcmnt[idx - 1];
 }
 
-/* ATTENTION */
-/* generally speaking the undo/redo basic functionality seems to be
- * working. what is not working always perfect, is the state of the
- * screen, i thing on redoing'it, so this has a very serious bug */
-private int buf_undo_exec (buf_t *this, utf8 com) {
-  Action_t *Action = NULL;
-  if (com is 'u')
-    Action = self(undo.pop);
-  else
-    Action = self(redo.pop);
+#define BUF_SYN_STATE_IDLE_NUM_ROWS 4096
 
-  if (NULL is Action) return NOTHING_TODO;
+/* computes the states of the next rows, while waiting for input */
+private int buf_syn_state_on_idle (buf_t *this) {
+  if (NULL is $my(syn)->multiline_comment_start or
+      NULL is $my(syn)->multiline_comment_end or this->num_items < 2)
+    return 0;
 
-  action_t *action = stack_pop (Action, action_t);
+  synstate_t *st = &$my(synstate);
+  if (st->syn is $my(syn) and st->num_items is this->num_items and
+      st->num_valid >= this->num_items - 1)
+    return 0;
 
-  Action_t *Redoact = self(Action.new);
+  int idx = (st->syn is $my(syn) ? st->num_valid : 0) + BUF_SYN_STATE_IDLE_NUM_ROWS;
+  if (idx > this->num_items - 1) idx = this->num_items - 1;
+
+  buf_syn_has_mlcmnt (this, self(get.row.at, idx), idx);
+  return st->num_valid < this->num_items - 1;
+}
+
+/* whether the current row, as it is edited, opens or closes a comment, so
+ * the rows that follow should be drawn again */
+private int buf_syn_state_has_changed (buf_t *this) {
+  int cur_idx = this->cur_idx;
+  if (cur_idx + 1 >= this->num_items) return 0;
+
+  int in_mlcmnt = buf_syn_has_mlcmnt (this, this->current, cur_idx);
+  if (NULL is $my(syn)->multiline_comment_start or
+      NULL is $my(syn)->multiline_comment_end)
+    return 0;
+
+  synstate_t *st = &$my(synstate);
+  int at_end = buf_syn_state_at_end (this, this->current, in_mlcmnt);
+  if (st->in_mlcmnt[cur_idx] is at_end) return 0;
+
+  st->in_mlcmnt[cur_idx] = at_end;
+  st->num_valid = cur_idx + 1;
+  return 1;
+}
+
+/* the rendered rows are cached by their address, and they are valid for as
+ * long as their content, their first column, whether they start in a comment,
+ * the width and the syntax remain the same, and no change has been pushed to
+ * the undo list since then */
+private void buf_render_cache_invalidate (buf_t *this) {
+  $my(render_cache).generation++;
+}
+
+private void buf_render_cache_free (buf_t *this) {
+  rowcache_t *slots = $my(render_cache).slots;
+  if (NULL is slots) return;
+
+  for (int i = 0; i < $my(render_cache).num_slots; i++)
+    ifnot (NULL is slots[i].render) string_free (slots[i].render);
+
+  free (slots);
+  $my(render_cache).slots = NULL;
+  $my(render_cache).num_slots = 0;
+}
+
+private uint32_t buf_render_cache_hash (string_t *data) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < data->num_bytes; i++) {
+    hash ^= (uchar) data->bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/* returns the slot of the row, that is valid if its row is set */
+private rowcache_t *buf_render_cache_get (buf_t *this, row_t *row, int idx, uint32_t hash) {
+  bufcache_t *cache = &$my(render_cache);
+
+  int num_slots = 4 * $my(dim)->num_rows;
+  if (num_slots < BUF_RENDER_CACHE_NUM_SLOTS)
+    num_slots = BUF_RENDER_CACHE_NUM_SLOTS;
+
+  if (cache->num_slots < num_slots) {
+    buf_render_cache_free (this);
+    cache->slots = Alloc (sizeof (rowcache_t) * num_slots);
+    cache->num_slots = num_slots;
+  }
+
+  if (cache->syn isnot $my(syn) or cache->num_items isnot this->num_items or
+      cache->num_cols isnot $my(dim)->num_cols or
+      cache->tabwidth isnot $my(ftype)->tabwidth) {
+    buf_render_cache_invalidate (this);
+    cache->syn = $my(syn);
+    cache->num_items = this->num_items;
+    cache->num_cols = $my(dim)->num_cols;
+    cache->tabwidth = $my(ftype)->tabwidth;
+  }
+
+  rowcache_t *rc = &cache->slots[((uintptr_t) row / sizeof (bufnode_t)) %
+      (uintptr_t) cache->num_slots];
+
+  int has_mlcmnt = buf_syn_has_mlcmnt (this, row, idx);
+
+  if (rc->row is row and rc->generation is cache->generation and
+      rc->hash is hash and rc->num_bytes is row->data->num_bytes and
+      rc->first_col_idx is row->first_col_idx and rc->has_mlcmnt is has_mlcmnt)
+    return rc;
+
+  rc->row = NULL;
+  rc->has_mlcmnt = has_mlcmnt;
+  return rc;
+}
+
+private void buf_render_cache_set (buf_t *this, rowcache_t *rc, row_t *row,
+                                         uint32_t hash, char *line) {
+  if (NULL is rc->render)
+    rc->render = string_new_with (line);
+  else
+    string_replace_with (rc->render, line);
+
+  rc->row = row;
+  rc->hash = hash;
+  rc->num_bytes = row->data->num_bytes;
+  rc->first_col_idx = row->first_col_idx;
+  rc->generation = $my(render_cache).generation;
+}
+
+/* the screen width of the character at sp, and its length in len */
+private int buf_get_char_width (buf_t *this, char *sp, char *end, int *len) {
+  uchar c = (uchar) *sp;
+  *len = 1;
+
+  if (c < 0x80) return (c is '\t' ? $my(ftype)->tabwidth : 1);
+
+  *len = Ustring.charlen (c);
+  if (sp + *len > end) *len = end - sp;
+  return cwidth (utf8_code (sp));
+}
+
+#define BUF_WRAP_CACHE_NUM_SLOTS 1024
+
+/* when the rows are wrapped, the points where their screen lines start, are
+ * cached by the address of the row, with the same rules as the rendered rows;
+ * the current row, which is edited in place, is always measured */
+private void buf_wrap_cache_invalidate (buf_t *this) {
+  $my(wrap_cache).generation++;
+}
+
+private void buf_wrap_cache_free (buf_t *this) {
+  rowwrap_t *slots = $my(wrap_cache).slots;
+  if (NULL is slots) return;
+
+  for (int i = 0; i < BUF_WRAP_CACHE_NUM_SLOTS; i++)
+    ifnot (NULL is slots[i].points) free (slots[i].points);
+
+  free (slots);
+  $my(wrap_cache).slots = NULL;
+}
+
+private void buf_wrap_add_point (rowwrap_t *rw, int idx) {
+  if (rw->num_points is rw->mem_size) {
+    rw->mem_size = (rw->mem_size ? rw->mem_size * 2 : 8);
+    rw->points = Realloc (rw->points, sizeof (int) * rw->mem_size);
+  }
+
+  rw->points[rw->num_points++] = idx;
+}
+
+/* returns the number of the screen lines of the row (at least one), and their
+ * first byte indices in points, which are valid until the next call */
+private int buf_wrap_get_points (buf_t *this, row_t *row, int **points) {
+  bufwrap_t *cache = &$my(wrap_cache);
+
+  if (NULL is cache->slots)
+    cache->slots = Alloc (sizeof (rowwrap_t) * BUF_WRAP_CACHE_NUM_SLOTS);
+
+  rowwrap_t *rw = &cache->slots[((uintptr_t) row / sizeof (bufnode_t)) %
+      BUF_WRAP_CACHE_NUM_SLOTS];
+
+  int num_cols = $my(dim)->num_cols;
+  int tabwidth = $my(ftype)->tabwidth;
+
+  if (rw->row is row and row isnot this->current and
+      rw->generation is cache->generation and
+      rw->num_bytes is row->data->num_bytes and
+      rw->num_cols is num_cols and rw->tabwidth is tabwidth) {
+    *points = rw->points;
+    return rw->num_points;
+  }
+
+  rw->row = row;
+  rw->num_bytes = row->data->num_bytes;
+  rw->num_cols = num_cols;
+  rw->tabwidth = tabwidth;
+  rw->generation = cache->generation;
+  rw->num_points = 0;
+
+  buf_wrap_add_point (rw, 0);
+
+  char *sp = row->data->bytes;
+  char *end = sp + row->data->num_bytes;
+  int col = 0;
+  int len;
+
+  while (sp < end and *sp) {
+    int width = buf_get_char_width (this, sp, end, &len);
+    if (col + width > num_cols and col > 0) {
+      buf_wrap_add_point (rw, sp - row->data->bytes);
+      col = 0;
+    }
+
+    col += width;
+    sp += len;
+  }
+
+  *points = rw->points;
+  return rw->num_points;
+}
+
+/* the screen line of the row, where the byte index belongs */
+private int buf_wrap_get_line (int *points, int num, int idx) {
+  int i = num - 1;
+  while (i > 0 and points[i] > idx) i--;
+  return i;
+}
+
+/* the screen width of the bytes of the row, from beg to idx */
+private int buf_wrap_get_width (buf_t *this, row_t *row, int beg, int idx) {
+  char *sp = row->data->bytes + beg;
+  char *end = row->data->bytes + idx;
+  int width = 0;
+  int len;
+
+  while (sp < end and *sp) {
+    width += buf_get_char_width (this, sp, end, &len);
+    sp += len;
+  }
+
+  return width;
+}
+
+/* the byte index of the character that is displayed at the screen column col
+ * of the nth screen line of the row, or of its last character */
+private int buf_wrap_get_col_idx (buf_t *this, row_t *row, int *points, int num,
+                                                             int nth, int col) {
+  char *bytes = row->data->bytes;
+  char *sp = bytes + points[nth];
+  char *end = (nth + 1 < num ? bytes + points[nth + 1] : bytes + row->data->num_bytes);
+  int width = 0;
+  int len;
+  int idx = sp - bytes;
+
+  while (sp < end and *sp) {
+    idx = sp - bytes;
+    width += buf_get_char_width (this, sp, end, &len);
+    if (width > col) break;
+    sp += len;
+  }
+
+  return idx;
+}
+
+private void buf_undo_push (buf_t *this, Action_t *action) {
+  if ($my(undo)->num_items > $myroots(max_num_undo_entries)) {
+    Action_t *tmp = list_pop_tail ($my(undo), Action_t);
+    self(Action.free, tmp);
+  }
+
+  ifnot ($my(undo)->state & VUNDO_RESET)
+    __buf_redo_clear__ (this);
+  else
+    $my(undo)->state &= ~VUNDO_RESET;
+
+  current_list_prepend ($my(undo), action);
+  buf_render_cache_invalidate (this);
+  buf_wrap_cache_invalidate (this);
+
+  for (action_t *act = action->head; act isnot NULL; act = act->next) {
+    buf_syn_state_invalidate (this, act->idx);
+    buf_match_invalidate (this, act->idx);
+  }
+}
+
+private void buf_redo_push (buf_t *this, Action_t *action) {
+  if ($my(redo)->num_items > $myroots(max_num_undo_entries)) {
+    Action_t *tmp = list_pop_tail ($my(redo), Action_t);
+    self(Action.free, tmp);
+  }
+
+  current_list_prepend ($my(redo), action);
+  buf_render_cache_invalidate (this);
+  buf_wrap_cache_invalidate (this);
+
+  for (action_t *act = action->head; act isnot NULL; act = act->next) {
+    buf_syn_state_invalidate (this, act->idx);
+    buf_match_invalidate (this, act->idx);
+  }
+}
+
+private int buf_undo_insert (buf_t *this, Action_t *redoact, action_t *act) {
+  ifnot (this->num_items) return DONE;
+
+  action_t *ract = self(action.new);
+  self(current.set, act->idx);
+  self(adjust.view);
+  ract->type = DELETE_LINE;
+  undo_set (ract, DELETE_LINE);
+  ract->idx = this->cur_idx;
+  ract->bytes = Cstring.dup ($mycur(data)->bytes, $mycur(data)->num_bytes);
+  stack_push (redoact, ract);
+
+  self(current.delete);
+
+  if (this->num_items) {
+    self(current.set, act->cur_idx);
+    self(adjust.marks, DELETE_LINE, act->idx, act->idx);
+    undo_restore (act);
+  }
+
+  return DONE;
+}
+
+private int buf_undo_delete_line (buf_t *this, Action_t *redoact, action_t *act) {
+  action_t *ract = self(action.new);
+  row_t *row = self(row.new_with, act->bytes);
+  if (this->num_items) {
+    if (act->idx >= this->num_items) {
+      self(current.set, this->num_items - 1);
+      self(adjust.view);
+      undo_set (ract, INSERT_LINE);
+      self(current.append, row);
+      ract->idx = this->cur_idx;
+    } else {
+      self(current.set, act->idx);
+      self(adjust.view);
+      undo_set (ract, INSERT_LINE);
+      self(current.prepend, row);
+      ract->idx = this->cur_idx;
+    }
+    stack_push (redoact, ract);
+    self(adjust.marks, INSERT_LINE, act->idx, act->idx + 1);
+    undo_restore (act);
+  } else {
+    self(current.append, row);
+    self(adjust.view);
+    undo_set (ract, INSERT_LINE);
+    stack_push (redoact, ract);
+    //  $my(video_first_row_idx) = this->cur_idx;
+  }
+
+  if ($my(video_first_row_idx) is this->cur_idx)
+    $my(video_first_row) = this->current;
+
+  return DONE;
+}
+
+private int buf_undo_replace_line (buf_t *this, Action_t *redoact, action_t *act) {
+  self(current.set, act->idx);
+
+  action_t *ract = self(action.new);
+  self(set.row.idx, act->idx, act->row_pos - $my(dim)->first_row, act->col_pos);
+  undo_set (ract, REPLACE_LINE);
+  ract->idx = this->cur_idx;
+  ract->bytes = Cstring.dup ($mycur(data)->bytes, $mycur(data)->num_bytes);
+  stack_push (redoact, ract);
+
+  String.replace_with ($mycur(data), act->bytes);
+
+  undo_restore (act);
+  return DONE;
+}
+
+/* ATTENTION */
+/* generally speaking the undo/redo basic functionality seems to be
+ * working. what is not working always perfect, is the state of the
+ * screen, i thing on redoing'it, so this has a very serious bug */
+private int buf_undo_exec (buf_t *this, utf8 com) {
+  Action_t *Action = NULL;
+  if (com is 'u')
+    Action = self(undo.pop);
+  else
+    Action = self(redo.pop);
+
+  if (NULL is Action) return NOTHING_TODO;
+
+  action_t *action = stack_pop (Action, action_t);
+
+  Action_t *Redoact = self(Action.new);
 
   while (action) {
     if (action->type is DELETE_LINE)
@@ -5376,7 +6716,7 @@ syn_t HL_DB[] = {
      NULL, NULL,
      NULL, NULL, NULL, NULL,
      HL_STRINGS_NO, HL_NUMBERS_NO, buf_syn_parser, buf_syn_init,
-     0, 0, NULL, NULL, c_balanced_pairs,
+     0, 0, NULL, NULL, c_balanced_pairs, NULL, NULL,
   },
   {
     "c", NULL_ARRAY, c_extensions, NULL_ARRAY,
@@ -5384,12 +6724,12 @@ syn_t HL_DB[] = {
     c_singleline_comment, c_multiline_comment_start, c_multiline_comment_end,
     c_multiline_comment_continuation,
     HL_STRINGS, HL_NUMBERS,
-    buf_syn_parser, buf_syn_init_c, 0, 0, NULL, NULL, c_balanced_pairs,
+    buf_syn_parser, buf_syn_init_c, 0, 0, NULL, NULL, c_balanced_pairs, NULL, NULL,
   },
   {
     "i", NULL_ARRAY, i_extensions, i_shebangs, i_keywords, i_operators,
     i_singleline_comment, NULL, NULL, NULL, HL_STRINGS, HL_NUMBERS,
-    buf_syn_parser, buf_syn_init_i, 0, 0, NULL, NULL, c_balanced_pairs
+    buf_syn_parser, buf_syn_init_i, 0, 0, NULL, NULL, c_balanced_pairs, NULL, NULL
   }
 };
 
@@ -5399,60 +6739,163 @@ syn_t HL_DB[] = {
 
 #define IGNORE(c) ((c) > '~' || (c) <= ' ')
 
-#define ADD_COLORED_CHAR(_c, _clr) String.append_fmt ($my(shared_str), \
-  TERM_SET_COLOR_FMT "%c" TERM_COLOR_RESET,(_clr), (_c))
+/* the class of every byte for a syntax, so the parser does not search the
+ * separators and the operators for every byte, and it appends the bytes of a
+ * word that can not start anything (see buf_syn_parser()), at once */
+#define SYN_BYTE_SEPARATOR (1 << 0)
+#define SYN_BYTE_OPERATOR  (1 << 1)
+#define SYN_BYTE_WORD      (1 << 2)
 
-#define ADD_INVERTED_CHAR(_c, _clr) String.append_fmt ($my(shared_str), \
-  TERM_INVERTED "%s%c" TERM_COLOR_RESET, TERM_MAKE_COLOR ((_clr)), (_c))
+#define SYN_IS_SEPARATOR(syn_, c_)               \
+  (NULL is (syn_)->byte_class ? IsSeparator (c_) : \
+   (syn_)->byte_class[(uchar) (c_)] & SYN_BYTE_SEPARATOR)
 
-#define SYN_HAS_OPEN_COMMENT       (1 << 0)
-#define SYN_HAS_SINGLELINE_COMMENT (1 << 1)
-#define SYN_HAS_MULTILINE_COMMENT  (1 << 2)
+private uchar *syn_byte_class_compile (syn_t *syn) {
+  uchar *classes = Alloc (sizeof (uchar) * 256);
 
-private int buf_syn_has_mlcmnt (buf_t *this, row_t *row) {
-  int found = 0;
-  row_t *it = row->prev;
+  for (int c = 0; c < 256; c++) {
+    if (IsSeparator (c)) classes[c] |= SYN_BYTE_SEPARATOR;
 
-  for (int i = 0; i < MAX_BACKTRACK_LINES_FOR_ML_COMMENTS and it; i++) {
-    ifnot (NULL is strstr (it->data->bytes, $my(syn)->multiline_comment_end))
-      break;
+    if (c and NULL isnot syn->operators and
+        NULL isnot cstring_byte_in_str (syn->operators, c))
+      classes[c] |= SYN_BYTE_OPERATOR;
 
-    char *sp = strstr (it->data->bytes, $my(syn)->multiline_comment_start);
+    if (0 is classes[c] and 0 is IGNORE (c) and 0 is IS_DIGIT (c) and
+        c isnot '"' and c isnot '\'')
+      classes[c] |= SYN_BYTE_WORD;
+  }
 
-    if (NULL isnot sp)
-      if (sp is it->data->bytes or
-          it->data->bytes[sp - it->data->bytes - 1] is ' ' or
-          it->data->bytes[sp - it->data->bytes - 1] is '\t') {
-        found = 1;
+  return classes;
+}
+
+/* the keywords are compiled (at ed_syn_append()) into an open addressing table
+ * of their hashes, and a word is looked up with a single pass over its bytes,
+ * at every length that there is a keyword and a separator follows; when more
+ * than one match, the first in the list wins, as with a linear search */
+private uint32_t syn_keywords_hash (uint32_t hash, uchar c) {
+  return (hash ^ c) * 16777619u;
+}
+
+private synkw_t *syn_keywords_compile (syn_t *syn) {
+  int num = 0;
+  int max_len = 0;
+  for (; syn->keywords[num] isnot NULL; num++)
+    if ((int) syn->keywords_len[num] > max_len)
+      max_len = syn->keywords_len[num];
+
+  synkw_t *kw = Alloc (sizeof (synkw_t));
+  kw->max_len = max_len;
+  kw->has_len = Alloc (sizeof (uchar) * (max_len + 1));
+  kw->num_slots = 16;
+  while (kw->num_slots < num * 2) kw->num_slots *= 2;
+  kw->slots = Alloc (sizeof (synkwslot_t) * kw->num_slots);
+
+  for (int j = 0; j < num; j++) {
+    int len = syn->keywords_len[j];
+    if (len <= 0) continue;
+
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < len; i++)
+      hash = syn_keywords_hash (hash, (uchar) syn->keywords[j][i]);
+
+    int i = hash & (kw->num_slots - 1);
+    while (kw->slots[i].keyword isnot NULL) {
+      if (kw->slots[i].len is len and
+          cstring_eq_n (kw->slots[i].keyword, syn->keywords[j], len))
         break;
+      i = (i + 1) & (kw->num_slots - 1);
+    }
+
+    ifnot (NULL is kw->slots[i].keyword) continue;
+
+    kw->slots[i] = (synkwslot_t) {
+      .keyword = syn->keywords[j], .hash = hash, .len = len, .idx = j,
+      .color = syn->keywords_colors[j]};
+
+    kw->has_len[len] = 1;
+  }
+
+  return kw;
+}
+
+private void syn_keywords_free (syn_t *syn) {
+  synkw_t *kw = syn->keywords_table;
+  if (NULL is kw) return;
+
+  free (kw->slots);
+  free (kw->has_len);
+  free (kw);
+  syn->keywords_table = NULL;
+}
+
+/* returns the length of the keyword at sp, and its color in color */
+private int syn_keywords_get (syn_t *syn, char *sp, int *color) {
+  synkw_t *kw = syn->keywords_table;
+
+  if (NULL is kw) {
+    for (int j = 0; syn->keywords[j] isnot NULL; j++) {
+      int kw_len = syn->keywords_len[j];
+      if (cstring_eq_n (sp, syn->keywords[j], kw_len) and SYN_IS_SEPARATOR (syn, sp[kw_len])) {
+        *color = syn->keywords_colors[j];
+        return kw_len;
       }
+    }
 
-    ifnot (NULL is $my(syn)->multiline_comment_continuation)
-      if (cstring_eq_n (it->data->bytes, $my(syn)->multiline_comment_continuation,
-      	$my(syn)->multiline_comment_continuation_len)) {
-        found = 1;
+    return 0;
+  }
+
+  synkwslot_t *found = NULL;
+  uint32_t hash = 2166136261u;
+
+  for (int len = 1; len <= kw->max_len and sp[len - 1]; len++) {
+    hash = syn_keywords_hash (hash, (uchar) sp[len - 1]);
+    if (0 is kw->has_len[len] or 0 is SYN_IS_SEPARATOR (syn, sp[len])) continue;
+
+    int i = hash & (kw->num_slots - 1);
+    while (kw->slots[i].keyword isnot NULL) {
+      synkwslot_t *slot = &kw->slots[i];
+      if (slot->hash is hash and slot->len is len and
+          cstring_eq_n (slot->keyword, sp, len)) {
+        if (NULL is found or slot->idx < found->idx) found = slot;
         break;
       }
 
-    it = it->prev;
+      i = (i + 1) & (kw->num_slots - 1);
+    }
   }
 
-  return found;
+  if (NULL is found) return 0;
+
+  *color = found->color;
+  return found->len;
 }
 
+#define ADD_COLORED_CHAR(_c, _clr) String.append_fmt ($my(shared_str), \
+  TERM_SET_COLOR_FMT "%c" TERM_COLOR_RESET,(_clr), (_c))
+
+#define ADD_INVERTED_CHAR(_c, _clr) String.append_fmt ($my(shared_str), \
+  TERM_INVERTED "%s%c" TERM_COLOR_RESET, TERM_MAKE_COLOR ((_clr)), (_c))
+
+#define SYN_HAS_OPEN_COMMENT       (1 << 0)
+#define SYN_HAS_SINGLELINE_COMMENT (1 << 1)
+#define SYN_HAS_MULTILINE_COMMENT  (1 << 2)
+
 /* Sorry but the highlight system is ridiculously simple (word by word), but is fast and works for me in C */
 private char *buf_syn_parser (buf_t *this, char *line, int len, int index, row_t *row) {
-  (void) index;
-
   ifnot (len) return line;
 
+  if (NULL is $my(syn)->byte_class)
+    $my(syn)->byte_class = syn_byte_class_compile ($my(syn));
+
+  uchar *classes = $my(syn)->byte_class;
+
   /* make sure to reset, in the case the last character on previous line
    * is in e.g., a string. Do it here instead with an "if" later on */
   String.replace_with_len ($my(shared_str), TERM_COLOR_RESET, TERM_COLOR_RESET_LEN);
 
   char *m_cmnt_p = NULL;
   int m_cmnt_idx = -1;
-  int has_mlcmnt  = 0;
+  int has_mlcmnt  = buf_syn_has_mlcmnt (this, row, index);
 
   ifnot (NULL is $my(syn)->multiline_comment_start) {
     m_cmnt_p = strstr (line, $my(syn)->multiline_comment_start);
@@ -5463,8 +6906,6 @@ private char *buf_syn_parser (buf_t *this, char *line, int len, int index, row_t
         m_cmnt_idx = -1;
         m_cmnt_p = NULL;
       }
-
-    if (m_cmnt_idx is -1) has_mlcmnt = buf_syn_has_mlcmnt (this, row);
   }
 
   char *s_cmnt_p = NULL;
@@ -5548,7 +6989,7 @@ parse_char:
 
     ifnot (NULL is $my(syn->operators)) {
       int lidx = idx;
-      while (NULL isnot Cstring.byte.in_str ($my(syn)->operators, c)) {
+      while (classes[c] & SYN_BYTE_OPERATOR) {
         ADD_COLORED_CHAR (c, HL_OPERATOR);
         if (++idx is len) goto theend;
         c = line[idx];
@@ -5591,34 +7032,34 @@ parse_char:
         goto theend;
       }
 
-    if (NULL isnot $my(syn)->keywords and (idx is 0 or IsSeparator (line[idx-1])))
-      for (int j = 0; $my(syn)->keywords[j] isnot NULL; j++) {
-        int kw_len = $my(syn)->keywords_len[j];
-        // int is_glob = $my(syn)->keywords[j][kw_len] is '*';if (is_glob) kw_len--;
+    if (NULL isnot $my(syn)->keywords and
+        (idx is 0 or classes[(uchar) line[idx-1]] & SYN_BYTE_SEPARATOR)) {
+      int color;
+      int kw_len = syn_keywords_get ($my(syn), &line[idx], &color);
 
-        if (cstring_eq_n (&line[idx], $my(syn)->keywords[j], kw_len) and
-           IsSeparator (line[idx + kw_len])) {
-         // (0 is is_glob ? IsSeparator (line[idx + kw_len]) : 1)) {
-          int color = $my(syn)->keywords_colors[j];
-          String.append ($my(shared_str), TERM_MAKE_COLOR (color));
+      if (kw_len) {
+        String.append ($my(shared_str), TERM_MAKE_COLOR (color));
 
-          for (int i = 0; i < kw_len; i++)
-            String.append_byte ($my(shared_str), line[idx+i]);
+        for (int i = 0; i < kw_len; i++)
+          String.append_byte ($my(shared_str), line[idx+i]);
 
-          idx += (kw_len - 1);
+        idx += (kw_len - 1);
 
-          // ifnot (is_glob) {
-          String.append ($my(shared_str), TERM_COLOR_RESET);
-          goto next_char;
-          // }
-          /*
-          idx++;
-          while (idx < len) String.append_byte ($my(shared_str), line[idx++]);
-          String.append ($my(shared_str), TERM_COLOR_RESET);
-          goto theend;
-          */
-        }
+        String.append ($my(shared_str), TERM_COLOR_RESET);
+        goto next_char;
       }
+    }
+
+    if (classes[c] & SYN_BYTE_WORD) {
+      int end = idx + 1;
+      while (end < len and (classes[(uchar) line[end]] & SYN_BYTE_WORD) and
+          end isnot m_cmnt_idx and end isnot s_cmnt_idx)
+        end++;
+
+      String.append_with_len ($my(shared_str), line + idx, end - idx);
+      idx = end - 1;
+      goto next_char;
+    }
 
     String.append_byte ($my(shared_str),  c);
 
@@ -5626,8 +7067,7 @@ next_char:;
   }
 
 theend:
-  Cstring.cp (line, MAXLEN_LINE, $my(shared_str)->bytes, $my(shared_str)->num_bytes);
-  return line;
+  return $my(shared_str)->bytes;
 }
 
 private void balanced_push (balanced_t *this, char obj, int idx) {
@@ -6009,6 +7449,26 @@ private int buf_com_set (buf_t *this, rline_t *rl) {
   if (rline_arg_exists (rl, "enable-writing"))
     $my(enable_writing) = 1;
 
+  if (rline_arg_exists (rl, "no-hlsearch")) {
+    buf_match_free (this);
+    draw = 1;
+  }
+
+  if (rline_arg_exists (rl, "wrap") or rline_arg_exists (rl, "no-wrap")) {
+    if (rline_arg_exists (rl, "wrap"))
+      $my(flags) |= BUF_SOFT_WRAP;
+    else {
+      $my(flags) &= ~BUF_SOFT_WRAP;
+      $my(video)->row_pos = $my(cur_video_row) =
+          $my(dim)->first_row + this->cur_idx - $my(video_first_row_idx);
+    }
+
+    $mycur(first_col_idx) = $mycur(cur_col_idx) = 0;
+    $my(video)->col_pos = $my(cur_video_col) =
+        Ustring.width ($mycur(data)->bytes, $my(ftype)->tabwidth);
+    draw = 1;
+  }
+
   if (draw) self(draw);
 
   return OK;
@@ -6102,27 +7562,285 @@ private void buf_set_modified (buf_t *this) {
   $my(flags) |= BUF_IS_MODIFIED;
 }
 
-private row_t *buf_row_new_with (buf_t *this, const char *bytes) {
-  row_t *row = AllocType (row);
-  string_t *data = String.new_with (bytes);
-  row->data = data;
-  return row;
+/* The row_t's and their string_t headers, are allocated in pairs from the
+ * chunks of a per buffer arena, and the released ones are kept in a free
+ * list. The lines that are read from a file and are short, are copied into
+ * payload chunks and their string does not own them (like the block store).
+ * All of it is released at once with the rows, see buf_free_rows(), and the
+ * payload chunks also on a reload, once no row uses them. */
+#define BUF_ARENA_NODES_PER_CHUNK  1024
+#define BUF_ARENA_CHUNK_SIZE       (1 << 16)
+#define BUF_ARENA_MAX_PAYLOAD      256
+
+private void *buf_arena_get (bufchunk_t **chunks, size_t size, size_t chunk_size) {
+  bufchunk_t *chunk = *chunks;
+
+  if (NULL is chunk or chunk->num_bytes + size > chunk->mem_size) {
+    chunk = Alloc (sizeof (bufchunk_t) + chunk_size);
+    chunk->bytes = (char *) (chunk + 1);
+    chunk->mem_size = chunk_size;
+    chunk->next = *chunks;
+    *chunks = chunk;
+  }
+
+  void *ptr = chunk->bytes + chunk->num_bytes;
+  chunk->num_bytes += size;
+  return ptr;
+}
+
+private void buf_arena_free_chunks (bufchunk_t **chunks) {
+  bufchunk_t *it = *chunks;
+  while (it) {
+    bufchunk_t *next = it->next;
+    free (it);
+    it = next;
+  }
+
+  *chunks = NULL;
+}
+
+private void buf_arena_free (buf_t *this) {
+  buf_arena_free_chunks (&$my(arena).nodes);
+  buf_arena_free_chunks (&$my(arena).payloads);
+  $my(arena).free_rows = NULL;
+}
+
+private row_t *buf_row_alloc (buf_t *this) {
+  bufnode_t *node = (bufnode_t *) $my(arena).free_rows;
+
+  if (NULL is node)
+    node = buf_arena_get (&$my(arena).nodes, sizeof (bufnode_t),
+        sizeof (bufnode_t) * BUF_ARENA_NODES_PER_CHUNK);
+  else {
+    $my(arena).free_rows = node->row.next;
+    memset (node, 0, sizeof (bufnode_t));
+  }
+
+  node->row.data = &node->data;
+  return &node->row;
 }
 
 private row_t *buf_row_new_with_len (buf_t *this, const char *bytes, size_t len) {
-  row_t *row = AllocType (row);
-  string_t *data = String.new_with_len (bytes, len);
-  row->data = data;
+  row_t *row = buf_row_alloc (this);
+  string_t *data = row->data;
+  data->mem_size = string_align (len + 1);
+  data->bytes = Alloc (data->mem_size);
+  data->num_bytes = cstring_cp (data->bytes, data->mem_size, bytes, len);
   return row;
 }
 
+private row_t *buf_row_new_with (buf_t *this, const char *bytes) {
+  size_t len = (NULL is bytes ? 0 : bytelen (bytes));
+  return buf_row_new_with_len (this, bytes, len);
+}
+
+/* the row references len bytes of a buffer block, and it is not owning them */
+private row_t *buf_row_new_from_block (buf_t *this, char *bytes, size_t len) {
+  row_t *row = buf_row_alloc (this);
+  row->data->bytes = bytes;
+  row->data->num_bytes = len;
+  return row;
+}
+
+/* used at load time, as the payload chunks are released only with the rows */
+private row_t *buf_row_new_from_arena (buf_t *this, const char *bytes, size_t len) {
+  if (len >= BUF_ARENA_MAX_PAYLOAD)
+    return buf_row_new_with_len (this, bytes, len);
+
+  char *buf = buf_arena_get (&$my(arena).payloads, len + 1, BUF_ARENA_CHUNK_SIZE);
+  byte_cp (buf, bytes, len);
+  buf[len] = '\0';
+  return buf_row_new_from_block (this, buf, len);
+}
+
+/* The rows are also linked in a weight balanced (scapegoat) tree, ordered by
+ * their position, and where every node holds the number of the nodes of its
+ * subtree, so an index is resolved in logarithmic time. The tree is updated
+ * by the buf_current_{append,prepend,delete}() family, while bulk operations
+ * just invalidate it, and it is rebuilt in linear time, when it is needed. */
+#define ROWIDX_MAX_DEPTH     128
+#define ROWIDX_MIN_DISTANCE  64
+#define ROWIDX_WEIGHT(n__) ((n__) is NULL ? 0 : (n__)->weight)
+/* alpha is 0.7 */
+#define ROWIDX_IS_UNBALANCED(n__) (                     \
+  ROWIDX_WEIGHT ((n__)->left)  * 10 > (n__)->weight * 7 or \
+  ROWIDX_WEIGHT ((n__)->right) * 10 > (n__)->weight * 7)
+
+private row_t *rowidx_build (row_t **it, int num) {
+  if (0 is num) return NULL;
+
+  int lnum = num / 2;
+  row_t *left = rowidx_build (it, lnum);
+  row_t *root = *it;
+  *it = root->next;
+  root->left = left;
+  root->right = rowidx_build (it, num - lnum - 1);
+  root->weight = num;
+  return root;
+}
+
+private int rowidx_max_depth (int num) {
+  int depth = 0;
+  long n = 1;
+  while (n < num) {
+    n = (n * 10) / 7 + 1;
+    depth++;
+  }
+
+  return depth;
+}
+
+private void buf_rowidx_invalidate (buf_t *this) {
+  $my(rowidx).is_valid = 0;
+  $my(rowidx).root = NULL;
+}
+
+private void buf_rowidx_rebuild (buf_t *this) {
+  row_t *it = this->head;
+  $my(rowidx).root = rowidx_build (&it, this->num_items);
+  $my(rowidx).max_items = this->num_items;
+  $my(rowidx).is_valid = 1;
+}
+
+private row_t *buf_rowidx_get_at (buf_t *this, int idx) {
+  ifnot ($my(rowidx).is_valid) buf_rowidx_rebuild (this);
+
+  row_t *node = $my(rowidx).root;
+  while (node) {
+    int lw = ROWIDX_WEIGHT (node->left);
+    if (idx is lw) return node;
+
+    if (idx < lw)
+      node = node->left;
+    else {
+      idx -= lw + 1;
+      node = node->right;
+    }
+  }
+
+  return NULL;
+}
+
+/* row is already linked in the list at idx */
+private void buf_rowidx_insert (buf_t *this, row_t *row, int idx) {
+  ifnot ($my(rowidx).is_valid) return;
+
+  row->left = row->right = NULL;
+  row->weight = 1;
+
+  row_t *path[ROWIDX_MAX_DEPTH];
+  int depth = 0;
+  row_t **link = &$my(rowidx).root;
+
+  while (*link) {
+    if (depth is ROWIDX_MAX_DEPTH) {
+      buf_rowidx_invalidate (this);
+      return;
+    }
+
+    row_t *node = *link;
+    path[depth++] = node;
+    node->weight++;
+
+    int lw = ROWIDX_WEIGHT (node->left);
+    if (idx <= lw)
+      link = &node->left;
+    else {
+      idx -= lw + 1;
+      link = &node->right;
+    }
+  }
+
+  *link = row;
+
+  if (this->num_items > $my(rowidx).max_items)
+    $my(rowidx).max_items = this->num_items;
+
+  if (depth <= rowidx_max_depth (this->num_items)) return;
+
+  for (int i = depth - 1; i >= 0; i--) {
+    row_t *node = path[i];
+    ifnot (ROWIDX_IS_UNBALANCED (node)) continue;
+
+    row_t *it = node;
+    while (it->left) it = it->left;
+    row_t *root = rowidx_build (&it, node->weight);
+
+    if (0 is i)
+      $my(rowidx).root = root;
+    else if (path[i - 1]->left is node)
+      path[i - 1]->left = root;
+    else
+      path[i - 1]->right = root;
+
+    return;
+  }
+}
+
+/* the row at idx is still linked in the list */
+private void buf_rowidx_delete (buf_t *this, int idx) {
+  ifnot ($my(rowidx).is_valid) return;
+
+  row_t **link = &$my(rowidx).root;
+
+  for (;;) {
+    row_t *node = *link;
+    if (NULL is node) {
+      buf_rowidx_invalidate (this);
+      return;
+    }
+
+    int lw = ROWIDX_WEIGHT (node->left);
+    if (idx is lw) break;
+
+    node->weight--;
+    if (idx < lw)
+      link = &node->left;
+    else {
+      idx -= lw + 1;
+      link = &node->right;
+    }
+  }
+
+  row_t *node = *link;
+
+  if (NULL is node->left)
+    *link = node->right;
+  else if (NULL is node->right)
+    *link = node->left;
+  else {
+    row_t **slink = &node->right;
+    while ((*slink)->left) {
+      (*slink)->weight--;
+      slink = &(*slink)->left;
+    }
+
+    row_t *succ = *slink;
+    *slink = succ->right;
+    succ->left = node->left;
+    succ->right = node->right;
+    succ->weight = node->weight - 1;
+    *link = succ;
+  }
+
+  if ((this->num_items - 1) * 10 < $my(rowidx).max_items * 7)
+    buf_rowidx_invalidate (this);
+}
+
 private int buf_get_row_col_idx (buf_t *this, row_t *row) {
   (void) this;
   return row->cur_col_idx;
 }
 
 private row_t *buf_get_row_at (buf_t *this, int idx) {
-  return list_get_at (this, row_t, idx);
+  if (0 > idx) idx += this->num_items;
+  if (idx < 0 or idx >= this->num_items) return NULL;
+  if (idx is this->cur_idx) return this->current;
+
+  if (idx < ROWIDX_MIN_DISTANCE or idx >= this->num_items - ROWIDX_MIN_DISTANCE)
+    return list_get_at (this, row_t, idx);
+
+  return buf_rowidx_get_at (this, idx);
 }
 
 private row_t *buf_get_row_current (buf_t *this) {
@@ -6149,14 +7867,14 @@ private string_t *buf_get_row_bytes_at (buf_t *this, int idx) {
 
 private void buf_free_row (buf_t *this, row_t *row) {
   if (row is NULL) return;
-  String.free (row->data);
-  free (row);
+  if (row->data->mem_size) free (row->data->bytes);
+  row->next = $my(arena).free_rows;
+  $my(arena).free_rows = row;
 }
 
 private void buf_free_line (buf_t *this) {
   if (this is NULL or $myprop is NULL or $my(line) is NULL) return;
-  ustring_free_members ($my(line));
-  free ($my(line));
+  ustring_free ($my(line));
 }
 
 private void buf_jumps_free (buf_t *this) {
@@ -6586,6 +8304,12 @@ private void buf_set_video_first_row (buf_t *this, int idx) {
 
   int num;
 
+  if (abs (idx - $my(video_first_row_idx)) > ROWIDX_MIN_DISTANCE) {
+    $my(video_first_row) = self(get.row.at, idx);
+    $my(video_first_row_idx) = idx;
+    return;
+  }
+
   if (idx < $my(video_first_row_idx)) {
     num = $my(video_first_row_idx) - idx;
     loop (num) $my(video_first_row) = $my(video_first_row)->prev;
@@ -6598,35 +8322,43 @@ private void buf_set_video_first_row (buf_t *this, int idx) {
 }
 
 private row_t *buf_current_prepend (buf_t *this, row_t *row) {
-  return current_list_prepend (this, row);
+  current_list_prepend (this, row);
+  buf_rowidx_insert (this, row, this->cur_idx);
+  buf_syn_state_invalidate (this, this->cur_idx);
+  buf_match_invalidate (this, this->cur_idx);
+  return row;
 }
 
 private row_t *buf_current_append (buf_t *this, row_t *row) {
-  return current_list_append (this, row);
+  current_list_append (this, row);
+  buf_rowidx_insert (this, row, this->cur_idx);
+  buf_syn_state_invalidate (this, this->cur_idx);
+  buf_match_invalidate (this, this->cur_idx);
+  return row;
 }
 
 private row_t *buf_append_with (buf_t *this, char *bytes) {
   row_t *row = self(row.new_with, bytes);
   int cur_idx = this->cur_idx;
   self(current.set, this->num_items - 1);
-  current_list_append (this, row);
+  buf_current_append (this, row);
   self(current.set, cur_idx);
   return row;
 }
 
 private row_t *buf_current_prepend_with(buf_t *this, char *bytes) {
   row_t *row = self(row.new_with, bytes);
-  return current_list_prepend (this, row);
+  return buf_current_prepend (this, row);
 }
 
 private row_t *buf_current_append_with (buf_t *this, char *bytes) {
   row_t *row = self(row.new_with, bytes);
-  return current_list_append (this, row);
+  return buf_current_append (this, row);
 }
 
 private row_t *buf_current_append_with_len (buf_t *this, char *bytes, size_t len) {
   row_t *row = self(row.new_with_len, bytes, len);
-  return current_list_append (this, row);
+  return buf_current_append (this, row);
 }
 
 private row_t *buf_current_replace_with (buf_t *this, char *bytes) {
@@ -6639,6 +8371,10 @@ private row_t *__buf_current_delete (buf_t *this, row_t **row) {
 
   *row = this->current;
 
+  buf_rowidx_delete (this, this->cur_idx);
+  buf_syn_state_invalidate (this, this->cur_idx);
+  buf_match_invalidate (this, this->cur_idx);
+
   if (this->num_items is 1) {
     this->current = NULL;
     this->head = NULL;
@@ -6702,7 +8438,11 @@ private row_t *buf_current_pop_next (buf_t *this) {
   return row;
 }
 
+private int buf_map_load (buf_t *, int);
+
 private char *buf_get_contents (buf_t *this, int addnl) {
+  buf_map_load (this, -1);
+
   size_t len = self(get.size) - (addnl ? 0 : this->num_items);
   char *buf = Alloc (len + 1);
 
@@ -6774,7 +8514,7 @@ private int buf_set_row_idx (buf_t *this, int idx, int ofs, int col) {
   if (idx < 0) idx = 0;
 
   do {
-    idx = current_list_set (this, idx);
+    idx = self(current.set, idx);
     if (idx is INDEX_ERROR) {
       idx--;
       continue;
@@ -6799,7 +8539,15 @@ private int buf_set_row_idx (buf_t *this, int idx, int ofs, int col) {
 }
 
 private int buf_current_set (buf_t *this, int idx) {
-  return current_list_set (this, idx);
+  if (0 > idx) idx += this->num_items;
+  if (idx < 0 or idx >= this->num_items) return INDEX_ERROR;
+
+  if (abs (idx - this->cur_idx) <= ROWIDX_MIN_DISTANCE)
+    return current_list_set (this, idx);
+
+  this->current = buf_rowidx_get_at (this, idx);
+  this->cur_idx = idx;
+  return idx;
 }
 
 private void buf_set_mode (buf_t *this, char *mode) {
@@ -7002,9 +8750,9 @@ private int buf_on_no_length (buf_t *this) {
   return OK;
 }
 
-private ssize_t ed_readline_from_fp (char **line, size_t *len, FILE *fp) {
+private ssize_t ed_readline_from_fd (fdlines_t *fdl, char **line) {
   ssize_t nread;
-  if (-1 is (nread = getline (line, len, fp))) return -1;
+  if (-1 is (nread = fdlines_get (fdl, line))) return -1;
   if (nread and ((*line)[nread - 1] is '\n' or (*line)[nread - 1] is '\r')) {
     (*line)[nread - 1] = '\0';
     nread--;
@@ -7055,6 +8803,297 @@ private int buf_com_save_image (buf_t *this, rline_t *rl) {
   return Root.save_image ($OurRoot, fn);
 }
 
+private void buf_free_blocks (buf_t *this) {
+  bufblock_t *it = $my(blocks);
+  while (it) {
+    bufblock_t *next = it->next;
+    free (it->bytes);
+    free (it);
+    it = next;
+  }
+
+  $my(blocks) = NULL;
+}
+
+/* on a reload, release the payload chunks that none of the rows reference
+ * anymore; the rows of a chunk are mostly consecutive, so the chunk of the
+ * previous row is tried first */
+private void buf_release_unused_payloads (buf_t *this) {
+  bufchunk_t *it;
+  for (it = $my(arena).payloads; it; it = it->next) it->is_referenced = 0;
+
+  bufchunk_t *last = NULL;
+  for (row_t *row = this->head; row; row = row->next) {
+    if (row->data->mem_size) continue;
+
+    char *bytes = row->data->bytes;
+    if (NULL isnot last and bytes >= last->bytes and
+        bytes < last->bytes + last->mem_size)
+      continue;
+
+    for (it = $my(arena).payloads; it; it = it->next)
+      if (bytes >= it->bytes and bytes < it->bytes + it->mem_size) {
+        it->is_referenced = 1;
+        last = it;
+        break;
+      }
+  }
+
+  bufchunk_t **itp = &$my(arena).payloads;
+  while (*itp) {
+    it = *itp;
+    if (it->is_referenced) {
+      itp = &it->next;
+      continue;
+    }
+
+    *itp = it->next;
+    free (it);
+  }
+}
+
+/* on a reload, release the blocks that none of the rows reference anymore */
+private void buf_release_unused_blocks (buf_t *this) {
+  bufblock_t **itp = &$my(blocks);
+  while (*itp) {
+    bufblock_t *it = *itp;
+    int is_referenced = 0;
+    row_t *row = this->head;
+    while (row and 0 is is_referenced) {
+      is_referenced = (0 is row->data->mem_size and
+          (ival_t) row->data->bytes >= (ival_t) it->bytes and
+          (ival_t) row->data->bytes <= (ival_t) (it->bytes + it->num_bytes));
+      row = row->next;
+    }
+
+    if (is_referenced) {
+      itp = &it->next;
+      continue;
+    }
+
+    *itp = it->next;
+    free (it->bytes);
+    free (it);
+  }
+}
+
+/* read the file into one block, split it in place and let the rows point
+ * into it; a row gets its own copy on its first modification, that needs
+ * more space (see string_reallocate()) */
+private ssize_t buf_read_fname_to_block (buf_t *this, FILE *fp) {
+  int fd = fileno (fp);
+  size_t mem_size = ($my(st).st_size > 0 ? (size_t) $my(st).st_size : BUFSIZ) + 1;
+  size_t num_bytes = 0;
+  char *bytes = Alloc (mem_size);
+
+  for (;;) {
+    if (num_bytes + 1 is mem_size) {
+      mem_size = (mem_size * 2) - 1;
+      bytes = Realloc (bytes, mem_size);
+    }
+
+    ssize_t nread = read (fd, bytes + num_bytes, mem_size - num_bytes - 1);
+    if (-1 is nread) {
+      if (EINTR is errno) continue;
+      break;
+    }
+
+    ifnot (nread) break;
+    num_bytes += nread;
+  }
+
+  ifnot (num_bytes) {
+    free (bytes);
+    return 0;
+  }
+
+  bytes[num_bytes] = '\0';
+
+  bufblock_t *block = AllocType (bufblock);
+  block->bytes = bytes;
+  block->num_bytes = num_bytes;
+  block->next = $my(blocks);
+  $my(blocks) = block;
+
+  size_t t_len = 0;
+  char *sp = bytes;
+  char *end = bytes + num_bytes;
+
+  while (sp < end) {
+    char *nl = memchr (sp, '\n', end - sp);
+    size_t len;
+
+    if (NULL is nl) {
+      len = end - sp;
+      /* like ed_readline_from_fd() */
+      if (sp[len - 1] is '\r') sp[--len] = '\0';
+    } else {
+      len = nl - sp;
+      *nl = '\0';
+    }
+
+    t_len += len;
+    /* an embedded null byte terminates the line, as with the getline() way */
+    buf_current_append (this, buf_row_new_from_block (this, sp, bytelen (sp)));
+
+    if (NULL is nl) break;
+    sp = nl + 1;
+  }
+
+  return t_len;
+}
+
+#define BUF_MAP_LOAD_NUM_ROWS 4096
+
+private void buf_map_release (buf_t *this) {
+  if (NULL is $my(map).bytes) return;
+  munmap ($my(map).bytes, $my(map).mem_size);
+  close ($my(map).fd);
+  $my(map).bytes = NULL;
+  $my(map).num_bytes = $my(map).mem_size = $my(map).offset = 0;
+}
+
+/* reading the mapping past the end of a file that has been truncated outside
+ * of the editor (as on a log rotation) raises SIGBUS, so the size is checked
+ * before the lines are read, and only the lines up to it are loaded */
+private void buf_map_clamp (buf_t *this) {
+  struct stat st;
+  if (-1 is fstat ($my(map).fd, &st) or (size_t) st.st_size >= $my(map).num_bytes)
+    return;
+
+  $my(map).num_bytes = ((size_t) st.st_size < $my(map).offset
+      ? $my(map).offset : (size_t) st.st_size);
+}
+
+/* turn up to num lines of the mapped file (all of them if num is negative)
+ * to rows, that are appended to the buffer, as the lines that are not rows
+ * yet, are always after the last row */
+private int buf_map_load (buf_t *this, int num) {
+  if (NULL is $my(map).bytes) return 0;
+
+  row_t *current = this->current;
+  int cur_idx = this->cur_idx;
+  this->current = this->tail;
+  this->cur_idx = this->num_items - 1;
+
+  if (0 > num) buf_rowidx_invalidate (this);
+
+  char *end = NULL;
+  int n = 0;
+
+  while (0 > num or n < num) {
+    if (0 is n % BUF_MAP_LOAD_NUM_ROWS) {
+      buf_map_clamp (this);
+      end = $my(map).bytes + $my(map).num_bytes;
+    }
+
+    if ($my(map).offset >= $my(map).num_bytes) break;
+
+    char *sp = $my(map).bytes + $my(map).offset;
+    char *nl = memchr (sp, '\n', end - sp);
+    size_t len = (NULL is nl ? (size_t) (end - sp) : (size_t) (nl - sp));
+    $my(map).offset += len + (NULL isnot nl);
+
+    /* like ed_readline_from_fd() */
+    if (NULL is nl and sp[len - 1] is '\r') len--;
+    char *nul = memchr (sp, '\0', len);
+    if (nul) len = nul - sp;
+
+    buf_current_append (this, buf_row_new_from_arena (this, sp, len));
+    n++;
+  }
+
+  ifnot (NULL is current) {
+    this->current = current;
+    this->cur_idx = cur_idx;
+  }
+
+  if ($my(map).offset >= $my(map).num_bytes)
+    buf_map_release (this);
+
+  return n;
+}
+
+private void buf_map_load_to (buf_t *this, int idx) {
+  if (NULL is $my(map).bytes or idx < this->num_items) return;
+
+  int num = idx - this->num_items + 1;
+  buf_map_load (this, (num < BUF_MAP_LOAD_NUM_ROWS ? BUF_MAP_LOAD_NUM_ROWS : num));
+}
+
+/* before a command in normal mode, load the rows that the command can reach;
+ * the commands that can reach any line, load them all */
+private void buf_map_load_for_normal (buf_t *this, utf8 com, int count) {
+  if (NULL is $my(map).bytes) return;
+
+  switch (com) {
+    case ':':
+      return; /* see buf_rline() */
+
+    case 'h': case 'j': case 'k': case 'l': case 'e': case 'E': case '0':
+    case '$': case '^': case 'x': case 'X': case 'J': case 'p': case 'P':
+    case 'r': case 'D': case 'C': case 'o': case 'O': case 'i': case 'a':
+    case 'A': case 'u': case 'm': case '`': case '~': case '>': case '<':
+    case '-': case '_': case ' ': case '\r': case 'q': case 'Q':
+    case ARROW_LEFT_KEY: case ARROW_RIGHT_KEY: case ARROW_UP_KEY:
+    case ARROW_DOWN_KEY: case PAGE_UP_KEY: case PAGE_DOWN_KEY: case HOME_KEY:
+    case END_KEY: case DELETE_KEY: case BACKSPACE_KEY: case ESCAPE_KEY:
+    case CTRL('f'): case CTRL('b'): case CTRL('r'): case CTRL('l'):
+    case CTRL('j'): case CTRL('a'): case CTRL('x'): case CTRL('o'):
+    case CTRL('i'): case CTRL('w'):
+      buf_map_load_to (this, this->cur_idx + (count + 2) * ONE_PAGE);
+      return;
+
+    default:
+      buf_map_load (this, -1);
+  }
+}
+
+/* writing the whole buffer to another file, copies the lines that are not
+ * rows from the mapping, so the rest of the commands need all the lines */
+private void buf_map_load_for_rline (buf_t *this, rline_t *rl) {
+  if (NULL is $my(map).bytes) return;
+
+  switch (rl->com) {
+    case VED_COM_QUIT_FORCE ... VED_COM_QUIT_ALIAS:
+    case VED_COM_EDIT_FORCE:
+    case VED_COM_EDIT_FORCE_ALIAS:
+    case VED_COM_EDIT:
+    case VED_COM_EDIT_ALIAS:
+      return;
+
+    case VED_COM_WRITE_FORCE ... VED_COM_WRITE_ALIAS:
+      if (NULL is Rline.get.arg (rl, RL_ARG_RANGE)) return;
+
+    default:
+      buf_map_load (this, -1);
+  }
+}
+
+private ssize_t buf_read_fname_to_map (buf_t *this, FILE *fp) {
+  ifnot ($my(st).st_size) return NOTOK;
+
+  int fd = dup (fileno (fp));
+  if (-1 is fd) return NOTOK;
+
+  char *bytes = mmap (NULL, $my(st).st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (MAP_FAILED is bytes) {
+    close (fd);
+    return NOTOK;
+  }
+
+  $my(map).bytes = bytes;
+  $my(map).fd = fd;
+  $my(map).num_bytes = $my(map).mem_size = $my(st).st_size;
+  $my(map).offset = 0;
+  $my(map).progress = 0;
+  $my(map).dev = $my(st).st_dev;
+  $my(map).ino = $my(st).st_ino;
+
+  buf_map_load (this, BUF_MAP_LOAD_NUM_ROWS);
+  return $my(st).st_size;
+}
+
 private ssize_t buf_read_fname (buf_t *this) {
   if ($my(fname) is NULL or cstring_eq ($my(fname), UNNAMED)) return NOTOK;
 
@@ -7093,16 +9132,47 @@ private ssize_t buf_read_fname (buf_t *this) {
     goto theend;
   }
 
-  char *line = NULL;
-  size_t len = 0;
+  ifnot (NULL is $my(arena).payloads)
+    buf_release_unused_payloads (this);
+
+  ifnot (NULL is $my(blocks))
+    buf_release_unused_blocks (this);
+
+  /* do not maintain the index for every line, it is rebuilt when needed */
+  buf_rowidx_invalidate (this);
+
+  /* on a reload, the lines that were not loaded yet, are dropped */
+  buf_map_release (this);
+
+  if (($my(flags) & BUF_USE_MMAP) or
+      (BUF_MMAP_MIN_SIZE and $my(st).st_size >= BUF_MMAP_MIN_SIZE)) {
+    ssize_t len = buf_read_fname_to_map (this, fp);
+    if (NOTOK isnot len) {
+      $my(flags) |= BUF_USE_MMAP;
+      t_len = len;
+      goto theend;
+    }
+  }
+
+  if (($my(flags) & BUF_USE_BLOCK_STORE) or
+      (BUF_BLOCK_STORE_MIN_SIZE and
+       $my(st).st_size >= BUF_BLOCK_STORE_MIN_SIZE)) {
+    $my(flags) |= BUF_USE_BLOCK_STORE;
+    t_len = buf_read_fname_to_block (this, fp);
+    goto theend;
+  }
+
+  fdlines_t fdl;
+  fdlines_init (&fdl, fileno (fp));
+  char *line;
   ssize_t nread;
 
-  while (-1 isnot (nread = ed_readline_from_fp (&line, &len, fp))) {
-    buf_current_append_with (this, line);
+  while (-1 isnot (nread = ed_readline_from_fd (&fdl, &line))) {
+    buf_current_append (this, buf_row_new_from_arena (this, line, bytelen (line)));
     t_len += nread;
   }
 
-  if (line isnot NULL) free (line);
+  fdlines_release (&fdl);
 
   /* actually this might be called only on :e! (and in that case we do not want it)
    * self(backupfile);
@@ -7252,12 +9322,22 @@ private int buf_on_normal_end (buf_t **thisp, utf8 com, int count, int regidx) {
 }
 
 private void buf_free_rows (buf_t *this) {
+  if (NULL is $myprop) return;
+
   row_t *row = this->head;
   while (row) {
-    row_t *next = row->next;
-    self(free.row, row);
-    row = next;
+    if (row->data->mem_size) free (row->data->bytes);
+    row = row->next;
   }
+
+  buf_arena_free (this);
+  buf_rowidx_invalidate (this);
+  buf_render_cache_invalidate (this);
+  buf_wrap_cache_invalidate (this);
+  buf_syn_state_invalidate (this, 0);
+  buf_match_invalidate (this, 0);
+  buf_free_blocks (this);
+  buf_map_release (this);
 }
 
 private void buf_free (buf_t *this) {
@@ -7276,19 +9356,24 @@ private void buf_free (buf_t *this) {
 
   String.free ($my(statusline));
   String.free ($my(shared_str));
+  String.free ($my(visible_line));
   String.free ($my(cur_insert));
 
   self(free.line);
   self(ftype.free);
   self(undo.free);
   self(jumps.free);
+  buf_render_cache_free (this);
+  buf_wrap_cache_free (this);
+  buf_syn_state_free (this);
+  buf_match_free (this);
 
   free ($myprop);
   free (this);
 }
 
 private size_t buf_get_size (buf_t *this) {
-  size_t size = 0;
+  size_t size = $my(map).num_bytes - $my(map).offset;
   row_t *it = this->head;
   while (it) {
     size += it->data->num_bytes + 1;
@@ -7447,6 +9532,7 @@ private buf_t *win_buf_init (win_t *w, int at_frame, int flags) {
   self(jumps.init);
 
   $my(shared_str) = String.new (128);
+  $my(visible_line) = String.new (MAXLEN_LINE);
   $my(statusline) = String.new (64);
   $my(cur_insert) = String.new (128);
 
@@ -8161,33 +10247,348 @@ private char *ed_error_string (ed_t *this, int err) {
   for (; *sp and *sp isnot ','; sp++) ebuf[i++] = *sp;
   ebuf[i] = '\0';
 
-  String.replace_with_len ($my(ed_str), ebuf, i);
-  return $my(ed_str)->bytes;
-}
+  String.replace_with_len ($my(ed_str), ebuf, i);
+  return $my(ed_str)->bytes;
+}
+
+private void ed_set_topline (ed_t *ed, buf_t *this) {
+  time_t tim = time (NULL);
+  struct tm *tm = localtime (&tim);
+
+  String.replace_with_fmt ($myroots(topline), TERM_SET_COLOR_FMT,
+      $myroots(env)->uid ? COLOR_TOPLINE : COLOR_SU);
+  String.append_fmt ($myroots(topline), "[%s] [pid %d]",
+    $my(mode), $from(ed, env)->pid);
+
+  char tmnow[32];
+  size_t len = strftime (tmnow, sizeof (tmnow), "[%a %d %H:%M:%S]", tm);
+  int pad = $my(dim->num_cols) - ($myroots(topline)->num_bytes - 5) - len;
+  if (pad > 0)
+    loop (pad) String.append_byte ($myroots(topline), ' ');
+  String.append ($myroots(topline), tmnow);
+  String.clear_at ($myroots(topline), $my(dim)->num_cols + 5);
+  String.append_fmt ($myroots(topline), TERM_COLOR_RESET);
+  Video.set.row_with ($my(video), 0, $myroots(topline)->bytes);
+}
+
+private void buf_set_draw_topline (buf_t *this) {
+  Ed.set.topline ($my(root), this);
+  Video.draw.row_at ($my(video), 1);
+}
+
+#define BUF_MATCH_IDLE_NUM_ROWS 4096
+
+/* the matches of the row, as with the search they do not overlap; an empty
+ * match ends the row, and after the first match '^' does not match */
+private int buf_match_row (buf_t *this, row_t *row) {
+  bufmatch_t *bm = &$my(matches);
+  regexp_t *re = bm->re;
+  char *bytes = row->data->bytes;
+  int len = row->data->num_bytes;
+  int bidx = 0;
+
+  bm->row_num_matches = 0;
+
+  while (bidx <= len) {
+    Re.reset_captures (re);
+    if (bidx) re->flags |= RE_NOTBOL;
+    if (0 > Re.exec (re, bytes + bidx, len - bidx)) break;
+
+    if (bm->row_num_matches is bm->row_matches_mem_size) {
+      bm->row_matches_mem_size = bm->row_matches_mem_size * 2 + 8;
+      bm->row_cols = Realloc (bm->row_cols, sizeof (int) * bm->row_matches_mem_size);
+      bm->row_lens = Realloc (bm->row_lens, sizeof (int) * bm->row_matches_mem_size);
+    }
+
+    bm->row_cols[bm->row_num_matches] = bidx + re->match_idx;
+    bm->row_lens[bm->row_num_matches] = re->match_len;
+    bm->row_num_matches++;
+
+    if (0 is re->match_len) break;
+    bidx += re->match_idx + re->match_len;
+  }
+
+  re->flags &= ~RE_NOTBOL;
+  Re.reset_captures (re);
+  return bm->row_num_matches;
+}
+
+/* whether the matches of the current row, which is edited in place, differ
+ * from those in the index */
+private int buf_match_current_has_changed (buf_t *this) {
+  bufmatch_t *bm = &$my(matches);
+  int first = bm->row_start[this->cur_idx];
+  int num = buf_match_row (this, this->current);
+
+  if (num isnot bm->row_start[this->cur_idx + 1] - first) return 1;
+
+  for (int i = 0; i < num; i++)
+    if (bm->row_cols[i] isnot bm->cols[first + i] or
+        bm->row_lens[i] isnot bm->lens[first + i])
+      return 1;
+
+  return 0;
+}
+
+/* computes the matches of the rows up to idx (the rows below num_valid are
+ * valid, and row_start[num_valid] is always num_matches) */
+private void buf_match_compute (buf_t *this, int idx) {
+  bufmatch_t *bm = &$my(matches);
+  if (NULL is bm->re) return;
+
+  int from = buf_num_items_sync (this, &bm->num_items);
+  if (-1 isnot from) buf_match_invalidate (this, from);
+
+  if (bm->row_mem_size < this->num_items + 1) {
+    bm->row_mem_size = this->num_items + (this->num_items / 2) + 64;
+    bm->row_start = Realloc (bm->row_start, sizeof (int) * bm->row_mem_size);
+    bm->row_start[bm->num_valid] = bm->num_matches;
+  }
+
+  if (this->cur_idx < bm->num_valid and buf_match_current_has_changed (this))
+    buf_match_invalidate (this, this->cur_idx);
+
+  if (idx > this->num_items) idx = this->num_items;
+  if (idx <= bm->num_valid) return;
+
+  int i = bm->num_valid;
+  row_t *row = self(get.row.at, i);
+
+  for (; i < idx and row; i++, row = row->next) {
+    bm->row_start[i] = bm->num_matches;
+
+    int num = buf_match_row (this, row);
+    if (0 is num) continue;
+
+    if (bm->num_matches + num > bm->mem_size) {
+      bm->mem_size = (bm->num_matches + num) * 2 + 64;
+      bm->rows = Realloc (bm->rows, sizeof (int) * bm->mem_size);
+      bm->cols = Realloc (bm->cols, sizeof (int) * bm->mem_size);
+      bm->lens = Realloc (bm->lens, sizeof (int) * bm->mem_size);
+    }
+
+    for (int j = 0; j < num; j++) {
+      bm->rows[bm->num_matches] = i;
+      bm->cols[bm->num_matches] = bm->row_cols[j];
+      bm->lens[bm->num_matches] = bm->row_lens[j];
+      bm->num_matches++;
+    }
+  }
+
+  bm->num_valid = i;
+  bm->row_start[i] = bm->num_matches;
+}
+
+/* sets the pattern of the index; the matches of a small buffer are computed
+ * at once, and those of a bigger one while waiting for input */
+private void buf_match_set (buf_t *this, char *pat) {
+  bufmatch_t *bm = &$my(matches);
+  if (NULL isnot bm->pat and Cstring.eq (bm->pat->bytes, pat)) return;
+
+  buf_match_free (this);
+  if (NULL is pat or '\0' is *pat) return;
+
+  bm->pat = String.new_with (pat);
+  bm->render = String.new (MAXLEN_LINE);
+  bm->re = Re.new (pat, 0, RE_MAX_NUM_CAPTURES, Re.compile);
+  bm->num_items = this->num_items;
+
+  if (this->num_items <= BUF_MATCH_IDLE_NUM_ROWS)
+    buf_match_compute (this, this->num_items);
+}
+
+/* brings the index in line with the number of the rows and with the current
+ * row; this is done once before the rows are rendered, as buf_match_get()
+ * only reads the index */
+private void buf_match_sync (buf_t *this) {
+  buf_match_compute (this, 0);
+}
+
+/* the matches of the row at idx, from the index, or of the row alone */
+private int buf_match_get (buf_t *this, row_t *row, int idx, int **cols, int **lens) {
+  bufmatch_t *bm = &$my(matches);
+  if (NULL is bm->re) return 0;
+
+  if (idx < bm->num_valid) {
+    *cols = bm->cols + bm->row_start[idx];
+    *lens = bm->lens + bm->row_start[idx];
+    return bm->row_start[idx + 1] - bm->row_start[idx];
+  }
+
+  int num = buf_match_row (this, row);
+  *cols = bm->row_cols;
+  *lens = bm->row_lens;
+  return num;
+}
+
+/* returns the number of the matches up to the cursor and sets num to the
+ * number of all, or returns -1 while the index is not complete */
+private int buf_match_position (buf_t *this, int *num) {
+  bufmatch_t *bm = &$my(matches);
+  if (NULL is bm->re or 0 is this->num_items) return -1;
+
+  if (this->num_items - bm->num_valid <= BUF_MATCH_IDLE_NUM_ROWS)
+    buf_match_compute (this, this->num_items);
+  else
+    buf_match_compute (this, 0);
+
+  if (bm->num_valid < this->num_items) return -1;
+
+  int m = bm->row_start[this->cur_idx];
+  while (m < bm->row_start[this->cur_idx + 1] and
+         bm->cols[m] <= $mycur(cur_col_idx))
+    m++;
+
+  *num = bm->num_matches;
+  return m;
+}
+
+/* moves the cursor to the byte index col of the row at idx */
+private int buf_match_move (buf_t *this, int idx, int col) {
+  if (idx isnot this->cur_idx)
+    self(normal.goto_linenr, idx + 1, DONOT_DRAW);
+
+  char *bytes = $mycur(data)->bytes;
+  int nth = 0;
+  for (int i = 0; i < col and bytes[i]; i++)
+    if (((uchar) bytes[i] & 0xC0) isnot 0x80) nth++;
+
+  self(normal.bol, DONOT_DRAW);
+  if (nth) self(normal.right, nth, DONOT_DRAW);
+  self(draw);
+  return DONE;
+}
+
+/* moves to the next (dir is 1) or to the previous match, around the ends of
+ * the buffer; once the index is complete, this takes constant time, and till
+ * then the index is computed only as far as the next match, while the last
+ * match before the start is looked up from the last row backwards */
+private int buf_match_goto (buf_t *this, int dir) {
+  bufmatch_t *bm = &$my(matches);
+  if (NULL is bm->re) return NOTHING_TODO;
+
+  int col = $mycur(cur_col_idx);
+  int m, last;
+
+  if (dir is 1) {
+    for (;;) {
+      int idx = bm->num_valid + BUF_MATCH_IDLE_NUM_ROWS;
+      if (idx <= this->cur_idx) idx = this->cur_idx + 1;
+      buf_match_compute (this, idx);
+      if (bm->num_valid <= this->cur_idx) return NOTHING_TODO;
+
+      m = bm->row_start[this->cur_idx];
+      last = bm->row_start[this->cur_idx + 1];
+      while (m < last and bm->cols[m] <= col) m++;
+
+      if (m < bm->num_matches or bm->num_valid < idx or
+          bm->num_valid is this->num_items)
+        break;
+    }
+
+    if (m is bm->num_matches) m = 0;
+  } else {
+    buf_match_compute (this, this->cur_idx + 1);
+    if (bm->num_valid <= this->cur_idx) return NOTHING_TODO;
+
+    m = bm->row_start[this->cur_idx];
+    last = bm->row_start[this->cur_idx + 1];
+    while (m < last and bm->cols[m] < col) m++;
+
+    if (--m < 0) {
+      row_t *row = self(get.row.at, this->num_items - 1);
+      for (int i = this->num_items - 1; i >= bm->num_valid and row;
+           i--, row = row->prev) {
+        int num = buf_match_row (this, row);
+        if (num) return buf_match_move (this, i, bm->row_cols[num - 1]);
+      }
+
+      m = bm->num_matches - 1;
+    }
+  }
+
+  if (0 is bm->num_matches) return NOTHING_TODO;
+
+  return buf_match_move (this, bm->rows[m], bm->cols[m]);
+}
+
+/* highlights the matches in the rendered line of the row, that is the output
+ * of buf_syn_parser() for the bytes of the row from the index beg; the source
+ * bytes are followed to map the expanded tabs, and the escape sequences of
+ * the parser are held while in a match, and are sent again after it */
+private char *buf_match_hl_line (buf_t *this, char *rendered, row_t *row,
+                                                         int idx, int beg) {
+  bufmatch_t *bm = &$my(matches);
+  if (NULL is bm->re or $my(syn)->parse isnot buf_syn_parser) return rendered;
+
+  int *cols, *lens;
+  int num = buf_match_get (this, row, idx, &cols, &lens);
+  if (0 is num) return rendered;
+
+  char *src = row->data->bytes;
+  int num_bytes = row->data->num_bytes;
+  if (beg > num_bytes) beg = num_bytes;
+
+  char style[MAXLEN_WORD];
+  int style_len = 0;
+  int sidx = beg, m = 0, in_match = 0;
+  char *sp = rendered;
+
+  String.clear (bm->render);
+
+  while (*sp) {
+    if (*sp is '\033') {
+      char *end = sp + 1;
+      if (*end is '[') {
+        end++;
+        while (*end and (*end < 0x40 or *end > 0x7e)) end++;
+        if (*end) end++;
+      }
+
+      int len = end - sp;
+      if (len is TERM_COLOR_RESET_LEN and Cstring.eq_n (sp, TERM_COLOR_RESET, len))
+        style_len = 0;
+      else if (style_len + len < MAXLEN_WORD) {
+        memcpy (style + style_len, sp, len);
+        style_len += len;
+      }
+
+      ifnot (in_match) String.append_with_len (bm->render, sp, len);
+      sp = end;
+      continue;
+    }
 
-private void ed_set_topline (ed_t *ed, buf_t *this) {
-  time_t tim = time (NULL);
-  struct tm *tm = localtime (&tim);
+    if (in_match and sidx >= cols[m] + lens[m]) {
+      in_match = 0;
+      String.append_with_len (bm->render, TERM_COLOR_RESET, TERM_COLOR_RESET_LEN);
+      String.append_with_len (bm->render, style, style_len);
+    }
 
-  String.replace_with_fmt ($myroots(topline), TERM_SET_COLOR_FMT,
-      $myroots(env)->uid ? COLOR_TOPLINE : COLOR_SU);
-  String.append_fmt ($myroots(topline), "[%s] [pid %d]",
-    $my(mode), $from(ed, env)->pid);
+    ifnot (in_match) {
+      while (m < num and (0 is lens[m] or cols[m] + lens[m] <= sidx)) m++;
 
-  char tmnow[32];
-  size_t len = strftime (tmnow, sizeof (tmnow), "[%a %d %H:%M:%S]", tm);
-  int pad = $my(dim->num_cols) - ($myroots(topline)->num_bytes - 5) - len;
-  if (pad > 0)
-    loop (pad) String.append_byte ($myroots(topline), ' ');
-  String.append ($myroots(topline), tmnow);
-  String.clear_at ($myroots(topline), $my(dim)->num_cols + 5);
-  String.append_fmt ($myroots(topline), TERM_COLOR_RESET);
-  Video.set.row_with ($my(video), 0, $myroots(topline)->bytes);
-}
+      if (m < num and sidx >= cols[m]) {
+        in_match = 1;
+        String.append_fmt (bm->render, TERM_INVERTED TERM_SET_COLOR_FMT, HL_SEARCH);
+      }
+    }
 
-private void buf_set_draw_topline (buf_t *this) {
-  Ed.set.topline ($my(root), this);
-  Video.draw.row_at ($my(video), 1);
+    int n = 1;
+    if (sidx < num_bytes and src[sidx] is '\t' and *sp isnot '\t') {
+      n = 0;
+      while (n < $my(ftype)->tabwidth and sp[n] is ' ') n++;
+      if (0 is n) n = 1;
+    }
+
+    String.append_with_len (bm->render, sp, n);
+    sp += n;
+    sidx++;
+  }
+
+  if (in_match)
+    String.append_with_len (bm->render, TERM_COLOR_RESET, TERM_COLOR_RESET_LEN);
+
+  return bm->render->bytes;
 }
 
 private void buf_set_statusline (buf_t *this) {
@@ -8209,6 +10610,14 @@ private void buf_set_statusline (buf_t *this) {
     this->num_items, $mycur(cur_col_idx), $mycur(data)->num_bytes, cur_code,
     ($my(flags) & FILE_IS_WRITABLE) ? "" : "[RDONLY]");
 
+  ifnot (NULL is $my(map).bytes)
+    String.append_fmt ($my(statusline), " [loading %d%%]", $my(map).progress);
+
+  int num_matches;
+  int nth_match = buf_match_position (this, &num_matches);
+  if (0 <= nth_match)
+    String.append_fmt ($my(statusline), " [match %d of %d]", nth_match, num_matches);
+
   String.clear_at ($my(statusline), $my(dim)->num_cols + TERM_SET_COLOR_FMT_LEN);
   String.append_fmt ($my(statusline), "%s", TERM_COLOR_RESET);
   Video.set.row_with ($my(video), $my(statusline_row) - 1, $my(statusline)->bytes);
@@ -8219,6 +10628,39 @@ private void buf_set_draw_statusline (buf_t *this) {
   Video.draw.row_at ($my(video), $my(statusline_row));
 }
 
+/* computes the matches of the next rows, while waiting for input, and draws
+ * the statusline with their number, when the index is complete */
+private int buf_match_on_idle (buf_t *this) {
+  bufmatch_t *bm = &$my(matches);
+  if (NULL is bm->re or bm->num_valid >= this->num_items) return 0;
+
+  buf_match_compute (this, bm->num_valid + BUF_MATCH_IDLE_NUM_ROWS);
+  if (bm->num_valid < this->num_items) return 1;
+
+  buf_set_draw_statusline (this);
+  return 0;
+}
+
+/* load the rest of a mapped file in chunks, while waiting for input in normal
+ * mode, and redraw the statusline when the progress changes */
+private int buf_map_load_on_idle (term_t *term, void *obj) {
+  (void) term;
+  buf_t *this = (buf_t *) obj;
+  if (NULL is $my(map).bytes) return 0;
+
+  buf_map_load (this, BUF_MAP_LOAD_NUM_ROWS);
+
+  int progress = (NULL is $my(map).bytes ? 100 :
+      (int) (($my(map).offset * 100) / $my(map).num_bytes));
+
+  if (progress isnot $my(map).progress) {
+    $my(map).progress = progress;
+    buf_set_draw_statusline (this);
+  }
+
+  return (NULL isnot $my(map).bytes);
+}
+
 private string_t *get_current_number (buf_t *this, int *fidx) {
   if ($mycur(data)->num_bytes is 0) return NULL;
 
@@ -8454,6 +10896,18 @@ private void ed_search_history_push (ed_t *this, char *bytes, size_t len) {
 private int buf_search (buf_t *this, char com, char *str, utf8 cc) {
   if (this->num_items is 0) return NOTHING_TODO;
 
+  /* the next and the previous match are found in the index of the matches
+   * of the last pattern */
+  if (str is NULL and (com is 'n' or com is 'N')) {
+    if ($my(history)->search->num_items is 0) return NOTHING_TODO;
+
+    char *pat = $my(history)->search->head->data->bytes;
+    buf_match_set (this, pat);
+    buf_match_goto (this, (com is 'n' ? 1 : -1));
+    MSG ("%c%s", (com is 'n' ? '/' : '?'), pat);
+    return DONE;
+  }
+
   int toggle = 0;
   int hist_called = 0; /* if this variable declared a little bit before the for loop
   * gcc will complain for "maybe used uninitialized" because the code can jump to
@@ -8506,15 +10960,6 @@ private int buf_search (buf_t *this, char com, char *str, utf8 cc) {
       else
         goto theloop;
 
-    } else if (com is 'n' or com is 'N') {
-      if ($my(history)->search->num_items is 0) return NOTHING_TODO;
-      sch->pat = String.new_with (his->data->bytes);
-      BYTES_TO_RLINE (rl, sch->pat->bytes, (int) sch->pat->num_bytes);
-
-      com = 'n' is com ? '/' : '?';
-      rl->prompt_char = com;
-      Rline.write_and_break (rl);
-      goto search;
     } else
       sch->pat = String.new (1);
   }
@@ -8633,7 +11078,8 @@ search:
 theend:
   if (sch->found) {
     ed_search_history_push ($my(root), sch->pat->bytes, sch->pat->num_bytes);
-    self(normal.goto_linenr, sch->idx + 1, DRAW);
+    buf_match_set (this, sch->pat->bytes);
+    buf_match_move (this, sch->idx, sch->col);
   }
 
   MSG(" ");
@@ -8666,36 +11112,167 @@ private int buf_grep_on_normal (buf_t **thisp, utf8 com, int count, int regidx)
   return retval + 1;
 }
 
-private int buf_search_file (buf_t *this, char *fname, regexp_t *re) {
-  FILE *fp = fopen (fname, "r");
-  if (fp is NULL) return NOTOK;
+#define GREP_MAP_WINDOW_SIZE (1 << 20)
 
-  size_t fnlen = bytelen (fname);
-  char *line = NULL;
-  size_t len = 0;
-  size_t nread = 0;
-  int idx = 0;
-  while (-1 isnot (int) (nread = ed_readline_from_fp (&line, &len, fp))) {
-    idx++;
-    int ret = Re.exec (re, line, nread);
-    if (ret is RE_UNBALANCED_BRACKETS_ERROR) {
-      MSG_ERRNO (RE_UNBALANCED_BRACKETS_ERROR);
-      break;
+/* searches a file mapped into memory; with a literal in the pattern, only the
+ * lines with an occurence of it are matched */
+private void grep_file (grepfile_t *gf, regexp_t *re) {
+  char *fname = gf->fname;
+  if (0 is file_exists (fname) or is_directory (fname) or
+      0 is file_is_readable (fname) or file_is_elf (fname))
+    return;
+
+  int fd = open (fname, O_RDONLY);
+  if (-1 is fd) return;
+
+  struct stat st;
+  if (-1 is fstat (fd, &st) or 0 is st.st_size) {
+    close (fd);
+    return;
+  }
+
+  size_t size = (size_t) st.st_size;
+  char *map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map is MAP_FAILED) {
+    close (fd);
+    return;
+  }
+
+  madvise (map, size, MADV_SEQUENTIAL);
+
+  string_t *line = string_new (MAXLEN_LINE);
+  const char *sp = map;
+  const char *end = map + size;
+  int linenr = 0;
+
+  while (sp < end) {
+    /* the file is read a window at a time, that ends at a line, and its size
+     * is checked before, as reading past the end of a file that has been
+     * truncated meanwhile, raises SIGBUS (like buf_map_clamp()) */
+    if (0 is fstat (fd, &st) and map + st.st_size < end) {
+      end = map + st.st_size;
+      if (sp >= end) break;
     }
-    if (ret is RE_NO_MATCH) continue;
 
-    size_t blen = (fnlen) + 32 + nread;
-    char bytes[blen + 1];
-    snprintf (bytes, blen, "%s|%d col %d| %s", fname, idx, re->match_idx, line);
-    buf_current_append_with (this, bytes);
-    Re.reset_captures (re);
+    const char *wend = end;
+    if (end - sp > GREP_MAP_WINDOW_SIZE) {
+      wend = memchr (sp + GREP_MAP_WINDOW_SIZE, '\n',
+          (size_t) (end - sp - GREP_MAP_WINDOW_SIZE));
+      wend = (NULL is wend ? end : wend + 1);
+    }
+
+    while (sp < wend) {
+      const char *lp = sp;
+
+      if (re->prog->literal_len and wend - sp <= INT_MAX) {
+        const char *m = re_literal_find (re->prog, sp, (int) (wend - sp), re->flags);
+
+        lp = (NULL is m ? wend : m);
+        while (lp > sp and *(lp - 1) isnot '\n') lp--;
+
+        const char *nl;
+        while (NULL isnot (nl = memchr (sp, '\n', (size_t) (lp - sp)))) {
+          linenr++;
+          sp = nl + 1;
+        }
+
+        if (NULL is m) {
+          sp = wend;
+          break;
+        }
+      }
+
+      const char *le = memchr (lp, '\n', (size_t) (wend - lp));
+      if (NULL is le) le = wend;
+
+      linenr++;
+      sp = le + 1;
+
+      string_replace_with_len (line, lp, (size_t) (le - lp));
+      int ret = re_exec (re, line->bytes, line->num_bytes);
+      if (ret is RE_UNBALANCED_BRACKETS_ERROR) {
+        gf->error = ret;
+        goto theend;
+      }
+
+      if (ret is RE_NO_MATCH) continue;
+
+      string_append_fmt (gf->lines, "%s|%d col %d| %s\n", fname, linenr,
+          re->match_idx, line->bytes);
+      re_reset_captures (re);
+    }
   }
 
-  fclose (fp);
-  if (line isnot NULL) free (line);
-  return 0;
+theend:
+  string_free (line);
+  munmap (map, size);
+  close (fd);
+}
+
+private void *grep_worker (void *arg) {
+  grepworker_t *w = arg;
+  grep_t *grep = w->grep;
+
+  for (;;) {
+    pthread_mutex_lock (&grep->mutex);
+    int idx = grep->next_file++;
+    pthread_mutex_unlock (&grep->mutex);
+
+    if (idx >= grep->num_files) break;
+
+    grepfile_t *gf = &grep->files[idx];
+    grep_file (gf, w->re);
+
+    pthread_mutex_lock (&grep->mutex);
+    gf->is_done = 1;
+    pthread_cond_signal (&grep->cond);
+    pthread_mutex_unlock (&grep->mutex);
+  }
+
+  return NULL;
+}
+
+private int grep_num_threads (int num_files) {
+  long num = sysconf (_SC_NPROCESSORS_ONLN);
+  if (num < 1) num = 1;
+  if (num > GREP_MAX_THREADS) num = GREP_MAX_THREADS;
+  if (num > num_files) num = num_files;
+  return (int) num;
+}
+
+/* the search window is displayed with the first results, and then it is drawn
+ * as the results of the next files are appended, at most BUF_DRAW_MAX_FPS
+ * times per second */
+private void buf_grep_draw (buf_t **thisp, buf_t *this, int *is_shown, long *draw_msec) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  long msec = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+  if (*is_shown) {
+#if BUF_DRAW_MAX_FPS
+    if (msec - *draw_msec < 1000 / BUF_DRAW_MAX_FPS) return;
+#endif
+    *draw_msec = msec;
+    self(draw);
+    return;
+  }
+
+  *is_shown = 1;
+  *draw_msec = msec;
+
+  self(set.video_first_row, 0);
+  self(current.set, 0);
+  $my(video)->row_pos = $my(cur_video_row);
+  $my(video)->col_pos = $my(cur_video_col);
+  self(normal.down, 1, DONOT_ADJUST_COL, DONOT_DRAW);
+  ifnot (Cstring.eq ($from((*thisp), fname), VED_SEARCH_BUF))
+    ed_buf_change ($my(root), thisp, VED_SEARCH_WIN, VED_SEARCH_BUF);
+  else
+    self(draw);
 }
 
+/* the files are searched by a pool of threads, while this thread appends the
+ * results in the order of the files, so they do not depend on the scheduling */
 private int buf_grep (buf_t **thisp, char *pat, Vstring_t *fnames) {
   buf_t *this = *thisp;
   int idx = 0;
@@ -8704,22 +11281,10 @@ private int buf_grep (buf_t **thisp, char *pat, Vstring_t *fnames) {
   if (this is NULL) return NOTHING_TODO;
   self(clear);
   String.replace_with_fmt ($mycur(data), "searching for %s", pat);
-  int flags = 0;
-  regexp_t *re = Re.new (pat, flags, RE_MAX_NUM_CAPTURES, Re.compile);
 
   vstring_t *it = fnames->head;
   char *dname = it is NULL ? NULL : it->data->bytes;
 
-  while (it) {
-    char *fname = it->data->bytes;
-    if (File.exists (fname))
-      ifnot (Dir.is_directory (fname))
-        if (File.is_readable (fname))
-          ifnot (File.is_elf (fname))
-            buf_search_file (this, fname, re);
-    it = it->next;
-  }
-
   ifnot (NULL is dname) {
     free ($my(cwd));
     if (*dname is '.' or *dname isnot DIR_SEP)
@@ -8728,20 +11293,84 @@ private int buf_grep (buf_t **thisp, char *pat, Vstring_t *fnames) {
       $my(cwd) = Path.dirname (dname);
   }
 
-  Re.free (re);
+  grep_t grep = {.num_files = fnames->num_items, .next_file = 0};
+  if (0 is grep.num_files) return NOTHING_TODO;
 
-  if (this->num_items is 1) return NOTHING_TODO;
+  grep.files = Alloc (sizeof (grepfile_t) * (size_t) grep.num_files);
+  for (int i = 0; it; it = it->next, i++) {
+    grep.files[i].fname = it->data->bytes;
+    grep.files[i].lines = String.new (8);
+  }
 
-  self(set.video_first_row, 0);
-  self(current.set, 0);
-  $my(video)->row_pos = $my(cur_video_row);
-  $my(video)->col_pos = $my(cur_video_col);
-  self(normal.down, 1, DONOT_ADJUST_COL, DONOT_DRAW);
-  ifnot (Cstring.eq ($from((*thisp), fname), VED_SEARCH_BUF))
-    ed_buf_change ($my(root), thisp, VED_SEARCH_WIN, VED_SEARCH_BUF);
-  else
-    self(draw);
+  pthread_mutex_init (&grep.mutex, NULL);
+  pthread_cond_init (&grep.cond, NULL);
+
+  int num_threads = grep_num_threads (grep.num_files);
+  grepworker_t workers[num_threads];
+  for (int i = 0; i < num_threads; i++) {
+    workers[i].grep = &grep;
+    workers[i].re = Re.new (pat, 0, RE_MAX_NUM_CAPTURES, Re.compile);
+    if (pthread_create (&workers[i].thread, NULL, grep_worker, &workers[i])) {
+      Re.free (workers[i].re);
+      num_threads = i;
+      break;
+    }
+  }
+
+  /* without a thread, this thread searches the files */
+  if (0 is num_threads) {
+    grepworker_t worker = {.grep = &grep,
+        .re = Re.new (pat, 0, RE_MAX_NUM_CAPTURES, Re.compile)};
+    grep_worker (&worker);
+    Re.free (worker.re);
+  }
+
+  int error = 0, is_shown = 0;
+  long draw_msec = 0;
+
+  for (int i = 0; i < grep.num_files; i++) {
+    grepfile_t *gf = &grep.files[i];
 
+    pthread_mutex_lock (&grep.mutex);
+    while (0 is gf->is_done)
+      pthread_cond_wait (&grep.cond, &grep.mutex);
+    pthread_mutex_unlock (&grep.mutex);
+
+    ifnot (error) error = gf->error;
+    if (0 is gf->lines->num_bytes) continue;
+
+    int cur_idx = this->cur_idx;
+    self(current.set, this->num_items - 1);
+
+    char *sp = gf->lines->bytes;
+    char *end = sp + gf->lines->num_bytes;
+    char *nl;
+    while (NULL isnot (nl = memchr (sp, '\n', (size_t) (end - sp)))) {
+      buf_current_append_with_len (this, sp, (size_t) (nl - sp));
+      sp = nl + 1;
+    }
+
+    self(current.set, cur_idx);
+    buf_grep_draw (thisp, this, &is_shown, &draw_msec);
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join (workers[i].thread, NULL);
+    Re.free (workers[i].re);
+  }
+
+  for (int i = 0; i < grep.num_files; i++)
+    String.free (grep.files[i].lines);
+
+  free (grep.files);
+  pthread_mutex_destroy (&grep.mutex);
+  pthread_cond_destroy (&grep.cond);
+
+  if (error) MSG_ERRNO (error);
+
+  if (this->num_items is 1) return NOTHING_TODO;
+
+  self(draw);
   return DONE;
 }
 
@@ -9071,14 +11700,15 @@ private int ed_reg_special_set (ed_t *this, buf_t *buf, int regidx) {
         FILE *fp = ed_file_pointer_from_X (this, (REG_STAR is regidx) ? X_PRIMARY : X_CLIPBOARD);
         if (NULL is fp) return ERROR;
         ed_reg_new (this, regidx);
-        size_t len = 0;
-        char *line = NULL;
+        fdlines_t fdl;
+        fdlines_init (&fdl, fileno (fp));
+        char *line;
 
-        // while (-1 isnot ed_readline_from_fp (&line, &len, fp)) {
+        // while (-1 isnot ed_readline_from_fd (&fdl, &line)) {
         // do it by hand to look for new lines and proper set the type
         ssize_t nread;
         int type = CHARWISE;
-        while (-1 isnot (nread = getline (&line, &len, fp))) {
+        while (-1 isnot (nread = fdlines_get (&fdl, &line))) {
           if (nread) {
             if (line[nread - 1] is '\n' or line[nread - 1] is '\r') {
               line[nread - 1] = '\0';
@@ -9090,7 +11720,7 @@ private int ed_reg_special_set (ed_t *this, buf_t *buf, int regidx) {
           }
         }
 
-        if (line isnot NULL) free (line);
+        fdlines_release (&fdl);
         pclose (fp);
         return DONE;
       }
@@ -9118,86 +11748,259 @@ private int ed_reg_special_set (ed_t *this, buf_t *buf, int regidx) {
       return NOTOK;
   }
 
-  return NOTHING_TODO;
+  return NOTHING_TODO;
+}
+
+private Reg_t *ed_reg_set_with (ed_t *this, int regidx, int type, char *bytes, int dir) {
+  if (regidx is REG_BLACKHOLE) return &$my(regs)[REG_BLACKHOLE];
+
+  ed_reg_new (this, regidx);
+  reg_t *reg = AllocType (reg);
+  reg->data = String.new_with (bytes);
+  if (-1 is dir)
+    return ed_reg_push_r (this, regidx, type, reg);
+  return ed_reg_push (this, regidx, type, reg);
+}
+
+private utf8 buf_quest (buf_t *this, char *qu, utf8 *chs, int len) {
+  video_paint_rows_with ($my(video), -1, -1, -1, qu);
+  SEND_ESC_SEQ ($my(video)->fd, TERM_CURSOR_HIDE);
+  utf8 c;
+  for (;;) {
+    c = Input.get ($my(term_ptr));
+    for (int i = 0; i < len; i++)
+      if (chs[i] is c) goto theend;
+  }
+
+theend:
+  video_resume_painted_rows ($my(video));
+  SEND_ESC_SEQ ($my(video)->fd, TERM_CURSOR_SHOW);
+  return c;
+}
+
+private utf8 ed_question (ed_t *this, char *qu, utf8 *chs, int len) {
+  return buf_quest (this->current->current, qu, chs, len);
+}
+
+/* only the characters that fit in the window, starting from the first column
+ * of the row (its byte index), are given to the syntax parser, so the time
+ * doesn't depend on the length of the line; long rows are not cached, as
+ * hashing them would */
+private char *buf_parse_line (buf_t *this, row_t *row, int idx) {
+  rowcache_t *rc = NULL;
+  uint32_t hash = 0;
+
+  if ($my(syn)->parse is buf_syn_parser and row->data->num_bytes <= MAXLEN_LINE) {
+    hash = buf_render_cache_hash (row->data);
+    rc = buf_render_cache_get (this, row, idx, hash);
+    ifnot (NULL is rc->row)
+      return buf_match_hl_line (this, rc->render->bytes, row, idx, row->first_col_idx);
+  }
+
+  string_t *line = $my(visible_line);
+  String.clear (line);
+
+  int first_col_idx = row->first_col_idx;
+  if (first_col_idx > (int) row->data->num_bytes)
+    first_col_idx = row->data->num_bytes;
+
+  char *sp = row->data->bytes + first_col_idx;
+  char *end = row->data->bytes + row->data->num_bytes;
+  int numchars = 0;
+
+  int len;
+
+  while (sp < end and *sp) {
+    int width = buf_get_char_width (this, sp, end, &len);
+    if (numchars + width > $my(dim)->num_cols) break;
+
+    String.append_with_len (line, sp, len);
+    numchars += width;
+    sp += len;
+  }
+
+  char *rendered = $my(syn)->parse (this, line->bytes, line->num_bytes, idx, row);
+
+  ifnot (NULL is rc)
+    buf_render_cache_set (this, rc, row, hash, rendered);
+
+  return buf_match_hl_line (this, rendered, row, idx, first_col_idx);
+}
+
+#define BUF_RENDER_IDLE_NUM_ROWS 16
+
+/* renders the rows of the page above and the page below the window into the
+ * cache, a few at a time, and then the comment state of the rest of the buffer;
+ * returns zero when there is nothing left to do */
+private int buf_render_on_idle (term_t *term, void *obj) {
+  (void) term;
+  buf_t *this = (buf_t *) obj;
+  if (0 is this->num_items) return 0;
+
+  bufcache_t *cache = &$my(render_cache);
+
+  if ($my(syn)->parse is buf_syn_parser and 0 is ($my(flags) & BUF_SOFT_WRAP)) {
+    int beg = $my(video_first_row_idx) - ONE_PAGE;
+    if (beg < 0) beg = 0;
+
+    int end = $my(video_first_row_idx) + 2 * ONE_PAGE;
+    if (end > this->num_items) end = this->num_items;
+
+    if (cache->idle_first_row isnot $my(video_first_row) or
+        cache->idle_generation isnot cache->generation) {
+      cache->idle_first_row = $my(video_first_row);
+      cache->idle_generation = cache->generation;
+      cache->idle_idx = beg;
+    }
+
+    if (cache->idle_idx < end) {
+      buf_match_sync (this);
+      row_t *row = self(get.row.at, cache->idle_idx);
+      for (int i = 0; i < BUF_RENDER_IDLE_NUM_ROWS and row isnot NULL and
+          cache->idle_idx < end; i++, row = row->next)
+        buf_parse_line (this, row, cache->idle_idx++);
+
+      return 1;
+    }
+  }
+
+  return buf_syn_state_on_idle (this);
+}
+
+/* while there is pending input, the draws of the current buffer are deferred
+ * until the input is consumed (then the editor draws it while it waits for
+ * input), or until it is time for the next frame */
+private int buf_draw_is_deferred (buf_t *this) {
+#if BUF_DRAW_MAX_FPS
+  term_t *term = $my(term_ptr);
+  if ($from(term, on_idle_obj) isnot $my(root) or
+      this isnot $my(root)->current->current)
+    return 0;
+
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  long msec = ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+  if (msec - $my(video)->draw_msec < 1000 / BUF_DRAW_MAX_FPS and
+      term_input_is_pending (term)) {
+    $my(state) |= BUF_DRAW_IS_DEFERRED;
+    return 1;
+  }
+
+  $my(video)->draw_msec = msec;
+#else
+  (void) this;
+#endif
+  return 0;
+}
+
+private void buf_draw_current_row (buf_t *this) {
+  if (buf_draw_is_deferred (this)) return;
+
+  if ($my(state) & BUF_DRAW_IS_DEFERRED or $my(flags) & BUF_SOFT_WRAP or
+      buf_syn_state_has_changed (this)) {
+    self(draw);
+    return;
+  }
+
+  buf_match_sync (this);
+  Video.set.row_with ($my(video), $my(video)->row_pos - 1,
+      buf_parse_line (this, this->current, this->cur_idx));
+  Video.draw.row_at ($my(video), $my(video)->row_pos);
+  buf_set_draw_statusline (this);
+  Cursor.set_pos ($my(term_ptr), $my(video)->row_pos, $my(video)->col_pos);
 }
 
-private Reg_t *ed_reg_set_with (ed_t *this, int regidx, int type, char *bytes, int dir) {
-  if (regidx is REG_BLACKHOLE) return &$my(regs)[REG_BLACKHOLE];
+/* the rows are displayed in whole, in as many screen lines as they need; the
+ * first row is first adjusted, so the cursor stays in the window, and when the
+ * current row can not fit, its first screen lines are not displayed */
+private void buf_to_video_wrapped (buf_t *this) {
+  int num_lines = $my(statusline_row) - $my(dim)->first_row;
+  int *points;
 
-  ed_reg_new (this, regidx);
-  reg_t *reg = AllocType (reg);
-  reg->data = String.new_with (bytes);
-  if (-1 is dir)
-    return ed_reg_push_r (this, regidx, type, reg);
-  return ed_reg_push (this, regidx, type, reg);
-}
+  if (this->cur_idx < $my(video_first_row_idx))
+    self(set.video_first_row, this->cur_idx);
 
-private utf8 buf_quest (buf_t *this, char *qu, utf8 *chs, int len) {
-  video_paint_rows_with ($my(video), -1, -1, -1, qu);
-  SEND_ESC_SEQ ($my(video)->fd, TERM_CURSOR_HIDE);
-  utf8 c;
-  for (;;) {
-    c = Input.get ($my(term_ptr));
-    for (int i = 0; i < len; i++)
-      if (chs[i] is c) goto theend;
+  int num = buf_wrap_get_points (this, this->current, &points);
+  int cur_line = buf_wrap_get_line (points, num, $mycur(cur_col_idx));
+
+  int lines = cur_line;
+  row_t *row = $my(video_first_row);
+  for (int idx = $my(video_first_row_idx); idx < this->cur_idx; idx++) {
+    lines += buf_wrap_get_points (this, row, &points);
+    row = row->next;
   }
 
-theend:
-  video_resume_painted_rows ($my(video));
-  SEND_ESC_SEQ ($my(video)->fd, TERM_CURSOR_SHOW);
-  return c;
-}
+  while (lines >= num_lines and $my(video_first_row_idx) < this->cur_idx) {
+    lines -= buf_wrap_get_points (this, $my(video_first_row), &points);
+    self(set.video_first_row, $my(video_first_row_idx) + 1);
+  }
 
-private utf8 ed_question (ed_t *this, char *qu, utf8 *chs, int len) {
-  return buf_quest (this->current->current, qu, chs, len);
-}
+  int skip = 0;
+  if (lines >= num_lines) {
+    skip = lines - num_lines + 1;
+    lines -= skip;
+  }
 
-private char *buf_parse_line (buf_t *this, row_t *row, char *line, int idx) {
-  Ustring.encode ($my(line), row->data->bytes, row->data->num_bytes,
-      CLEAR, $my(ftype)->tabwidth, row->first_col_idx);
+  string_t *line = $my(visible_line);
+  row = $my(video_first_row);
+  int idx = $my(video_first_row_idx);
+  int i = $my(dim)->first_row - 1;
 
-  int numchars = 0;
-  int j = 0;
+  while (row isnot NULL and i < $my(statusline_row) - 1) {
+    num = buf_wrap_get_points (this, row, &points);
 
-  ustring_t *it = $my(line)->current;
-  ustring_t *tmp = it;
-  while (it and numchars < $my(dim)->num_cols) {
-    for (int i = 0; i < it->len; i++) line[j++] = it->buf[i];
-    numchars += it->width;
-    tmp = it;
-    it = it->next;
+    for (int n = skip; n < num and i < $my(statusline_row) - 1; n++) {
+      int end = (n + 1 < num ? points[n + 1] : (int) row->data->num_bytes);
+      String.replace_with_len (line, row->data->bytes + points[n], end - points[n]);
+      Video.set.row_with ($my(video), i++, buf_match_hl_line (this,
+          $my(syn)->parse (this, line->bytes, line->num_bytes, idx, row),
+          row, idx, points[n]));
+    }
+
+    skip = 0;
+    row = row->next;
+    idx++;
   }
 
-  it = tmp;
-  while (numchars > $my(dim)->num_cols) {
-    j -= it->len;
-    numchars -= it->width;
-    it = it->prev;
+  while (i < $my(statusline_row) - 1)
+    Video.set.row_with ($my(video), i++, $my(ftype)->on_emptyline->bytes);
+
+  num = buf_wrap_get_points (this, this->current, &points);
+  int cur_idx = $mycur(cur_col_idx);
+  int col = buf_wrap_get_width (this, this->current, points[cur_line], cur_idx);
+
+  if (IS_MODE (INSERT_MODE) or cur_idx >= (int) $mycur(data)->num_bytes)
+    col++;
+  else {
+    int len;
+    col += buf_get_char_width (this, $mycur(data)->bytes + cur_idx,
+        $mycur(data)->bytes + $mycur(data)->num_bytes, &len);
   }
 
-  line[j] = '\0';
-  return $my(syn)->parse (this, line, j, idx, row);
-}
+  if (col > $my(dim)->num_cols) col = $my(dim)->num_cols;
 
-private void buf_draw_current_row (buf_t *this) {
-  char line[MAXLEN_LINE];
-  buf_parse_line (this, this->current, line, this->cur_idx);
-  Video.set.row_with ($my(video), $my(video)->row_pos - 1, line);
-  Video.draw.row_at ($my(video), $my(video)->row_pos);
-  buf_set_draw_statusline (this);
-  Cursor.set_pos ($my(term_ptr), $my(video)->row_pos, $my(video)->col_pos);
+  $my(video)->row_pos = $my(cur_video_row) = $my(dim)->first_row + lines;
+  $my(video)->col_pos = $my(cur_video_col) = col;
+
+  buf_set_statusline (this);
 }
 
 private void buf_to_video (buf_t *this) {
+  buf_match_sync (this);
+
+  if ($my(flags) & BUF_SOFT_WRAP) {
+    buf_to_video_wrapped (this);
+    return;
+  }
+
   row_t *row = $my(video_first_row);
   int idx = $my(video_first_row_idx);
-  char line[MAXLEN_LINE];
 
   int i;
   for (i = $my(dim)->first_row - 1; i < $my(statusline_row) - 1; i++) {
     if (row is NULL) break;
-    buf_parse_line (this, row, line, idx++);
-    Video.set.row_with ($my(video), i, line);
+    Video.set.row_with ($my(video), i, buf_parse_line (this, row, idx++));
     row = row->next;
   }
 
@@ -9208,6 +12011,7 @@ private void buf_to_video (buf_t *this) {
 }
 
 private void buf_flush (buf_t *this) {
+  video_scroll_frame ($my(video), $my(dim)->first_row, $my(statusline_row) - 1);
   video_render_set_from_to ($my(video), $my(dim)->first_row, $my(statusline_row));
   String.append_fmt ($my(video)->render, TERM_GOTO_PTR_POS_FMT,
       $my(video)->row_pos, $my(video)->col_pos);
@@ -9215,6 +12019,9 @@ private void buf_flush (buf_t *this) {
 }
 
 private void buf_draw (buf_t *this) {
+  if (buf_draw_is_deferred (this)) return;
+  $my(state) &= ~BUF_DRAW_IS_DEFERRED;
+
   String.clear ($my(video)->render);
   Ed.set.topline ($my(root), this);
   video_render_set_from_to ($my(video), $myroots(topline_row), $myroots(topline_row));
@@ -9653,6 +12460,8 @@ private int buf_normal_up (buf_t *this, int count, int adjust_col, int draw) {
 }
 
 private int buf_normal_down (buf_t *this, int count, int adjust_col, int draw) {
+  buf_map_load_to (this, this->cur_idx + count + ONE_PAGE);
+
   int currow_idx = this->cur_idx;
   if (this->num_items - 1 is currow_idx)
     return NOTHING_TODO;
@@ -9693,6 +12502,8 @@ private int buf_normal_down (buf_t *this, int count, int adjust_col, int draw) {
 }
 
 private int buf_normal_page_down (buf_t *this, int count, int draw) {
+  buf_map_load_to (this, $my(video_first_row_idx) + (count + 1) * ONE_PAGE);
+
   if (this->num_items < ONE_PAGE
       or this->num_items - $my(video_first_row_idx) < ONE_PAGE + 1)
     return NOTHING_TODO;
@@ -9765,6 +12576,95 @@ private int buf_normal_page_up (buf_t *this, int count, int draw) {
   return DONE;
 }
 
+/* when the rows are wrapped, the vertical motions move by screen lines, and
+ * they keep the screen column; the window follows the cursor (see
+ * buf_to_video_wrapped()) */
+private int buf_wrap_move (buf_t *this, int count) {
+  int *points;
+  int num = buf_wrap_get_points (this, this->current, &points);
+  int nth = buf_wrap_get_line (points, num, $mycur(cur_col_idx));
+  int col = buf_wrap_get_width (this, this->current, points[nth], $mycur(cur_col_idx));
+  int orig_idx = this->cur_idx;
+  int orig_nth = nth;
+
+  if (count > 0)
+    buf_map_load_to (this, this->cur_idx + count + ONE_PAGE);
+
+  while (count > 0) {
+    if (nth + 1 < num)
+      nth++;
+    else if (this->cur_idx < this->num_items - 1) {
+      buf_on_blankline (this);
+      self(current.set, this->cur_idx + 1);
+      num = buf_wrap_get_points (this, this->current, &points);
+      nth = 0;
+    } else
+      break;
+
+    count--;
+  }
+
+  while (count < 0) {
+    if (nth > 0)
+      nth--;
+    else if (this->cur_idx > 0) {
+      buf_on_blankline (this);
+      self(current.set, this->cur_idx - 1);
+      num = buf_wrap_get_points (this, this->current, &points);
+      nth = num - 1;
+    } else
+      break;
+
+    count++;
+  }
+
+  if (this->cur_idx is orig_idx and nth is orig_nth)
+    return NOTHING_TODO;
+
+  num = buf_wrap_get_points (this, this->current, &points);
+  $mycur(cur_col_idx) = buf_wrap_get_col_idx (this, this->current, points, num, nth, col);
+  $mycur(first_col_idx) = 0;
+  return DONE;
+}
+
+private int buf_wrap_down (buf_t *this, int count) {
+  if (NOTHING_TODO is buf_wrap_move (this, count)) return NOTHING_TODO;
+  self(draw);
+  return DONE;
+}
+
+private int buf_wrap_up (buf_t *this, int count) {
+  if (NOTHING_TODO is buf_wrap_move (this, -count)) return NOTHING_TODO;
+  self(draw);
+  return DONE;
+}
+
+/* the last row of the window becomes the first */
+private int buf_wrap_page_down (buf_t *this, int count) {
+  int num_lines = $my(statusline_row) - $my(dim)->first_row;
+
+  self(mark.set, MARK_UNNAMED);
+
+  if (NOTHING_TODO is buf_wrap_move (this, count * (num_lines - 1)))
+    return NOTHING_TODO;
+
+  self(set.video_first_row, this->cur_idx);
+  self(draw);
+  return DONE;
+}
+
+private int buf_wrap_page_up (buf_t *this, int count) {
+  int num_lines = $my(statusline_row) - $my(dim)->first_row;
+
+  self(mark.set, MARK_UNNAMED);
+
+  if (NOTHING_TODO is buf_wrap_move (this, -count * (num_lines - 1)))
+    return NOTHING_TODO;
+
+  self(draw);
+  return DONE;
+}
+
 private int buf_normal_bof (buf_t *this, int draw) {
   if (this->cur_idx is 0) return NOTHING_TODO;
 
@@ -11005,9 +13905,9 @@ private int buf_normal_put (buf_t *this, int regidx, utf8 com) {
       linewise_num++;
 
       if ('p' is com)
-        current_list_append (this, row);
+        self(current.append, row);
       else
-        current_list_prepend (this, row);
+        self(current.prepend, row);
 
       action->idx = this->cur_idx;
     } else {
@@ -12474,6 +15374,168 @@ private int ed_win_delete (ed_t *this, buf_t **thisp, int count_special) {
   return DONE;
 }
 
+private int buf_writer_flush (bufwriter_t *w) {
+  int idx = 0;
+
+  while (idx < w->num_iov) {
+    ssize_t n = writev (w->fd, w->iov + idx, w->num_iov - idx);
+    if (NOTOK is n) {
+      if (errno is EINTR) continue;
+      return NOTOK;
+    }
+
+    /* skip the fully written vectors, and adjust a partially written one */
+    while (idx < w->num_iov and n >= (ssize_t) w->iov[idx].iov_len)
+      n -= w->iov[idx++].iov_len;
+
+    if (n) {
+      w->iov[idx].iov_base = (char *) w->iov[idx].iov_base + n;
+      w->iov[idx].iov_len -= n;
+    }
+  }
+
+  w->num_iov = 0;
+  return OK;
+}
+
+private int buf_writer_add (bufwriter_t *w, char *bytes, size_t len) {
+  ifnot (len) return OK;
+
+  if (w->num_iov is BUF_WRITER_NUM_IOV)
+    if (NOTOK is buf_writer_flush (w)) return NOTOK;
+
+  w->iov[w->num_iov].iov_base = bytes;
+  w->iov[w->num_iov++].iov_len = len;
+  w->num_bytes += len;
+  return OK;
+}
+
+/* write the rows from fidx to lidx and when lidx is the last row, the lines
+ * of a mapped file that are not rows yet, as they are */
+private int buf_write_rows_to_fd (buf_t *this, int fd, int fidx, int lidx, size_t *bts) {
+  bufwriter_t w;
+  w.fd = fd;
+  w.num_iov = 0;
+  w.num_bytes = 0;
+
+  row_t *it = buf_get_row_at (this, fidx);
+
+  for (int idx = fidx; idx <= lidx and it isnot NULL; idx++, it = it->next)
+    if (NOTOK is buf_writer_add (&w, it->data->bytes, it->data->num_bytes) or
+        NOTOK is buf_writer_add (&w, "\n", 1))
+      return NOTOK;
+
+  if (lidx is this->num_items - 1 and NULL isnot $my(map).bytes)
+    buf_map_clamp (this);
+
+  if (lidx is this->num_items - 1 and NULL isnot $my(map).bytes and
+      $my(map).num_bytes > $my(map).offset) {
+    if (NOTOK is buf_writer_add (&w, $my(map).bytes + $my(map).offset,
+        $my(map).num_bytes - $my(map).offset))
+      return NOTOK;
+
+    if ($my(map).bytes[$my(map).num_bytes - 1] isnot '\n')
+      if (NOTOK is buf_writer_add (&w, "\n", 1)) return NOTOK;
+  }
+
+  if (NOTOK is buf_writer_flush (&w)) return NOTOK;
+
+  *bts = w.num_bytes;
+  return OK;
+}
+
+/* an existing regular file with a single link, is replaced by a temporary file
+ * in the same directory, so an interrupted write never truncates it; otherwise
+ * (appending, symbolic and hard links, or an unwritable directory) is written
+ * in place */
+private int buf_write_rows (buf_t *this, char *fname, int fidx, int lidx,
+                                   int append, size_t *bts, double *secs) {
+  struct timespec beg, end;
+  clock_gettime (CLOCK_MONOTONIC, &beg);
+
+  struct stat st;
+  int fexists = (OK is lstat (fname, &st));
+
+  char tmpname[PATH_MAX + 8];
+  int is_atomic = (0 is append and fexists and S_ISREG (st.st_mode) and
+      1 is st.st_nlink and bytelen (fname) < PATH_MAX);
+
+  int fd = -1;
+
+  if (is_atomic) {
+    snprintf (tmpname, PATH_MAX + 8, "%s.XXXXXX", fname);
+    if (NOTOK is (fd = mkstemp (tmpname)))
+      is_atomic = 0;
+    else {
+      /* do not change the ownership of the file, write it in place instead */
+      if (NOTOK is fchmod (fd, st.st_mode & 07777) or
+          NOTOK is fchown (fd, st.st_uid, st.st_gid)) {
+        close (fd);
+        unlink (tmpname);
+        is_atomic = 0;
+      }
+    }
+  }
+
+  ifnot (is_atomic) {
+    /* the mapped file is going to be truncated */
+    if (NULL isnot $my(map).bytes and OK is stat (fname, &st) and
+        st.st_dev is $my(map).dev and st.st_ino is $my(map).ino)
+      buf_map_load (this, -1);
+
+    fd = open (fname, O_WRONLY|O_CREAT|(append ? O_APPEND : O_TRUNC), 0666);
+    if (NOTOK is fd) return NOTOK;
+  }
+
+  if (NOTOK is buf_write_rows_to_fd (this, fd, fidx, lidx, bts) or
+      (BUF_WRITE_FSYNC and NOTOK is fsync (fd))) {
+    int err = errno;
+    close (fd);
+    if (is_atomic) unlink (tmpname);
+    errno = err;
+    return NOTOK;
+  }
+
+  if (NOTOK is close (fd)) {
+    int err = errno;
+    if (is_atomic) unlink (tmpname);
+    errno = err;
+    return NOTOK;
+  }
+
+  if (is_atomic) {
+    if (NOTOK is rename (tmpname, fname)) {
+      int err = errno;
+      unlink (tmpname);
+      errno = err;
+      return NOTOK;
+    }
+
+    if (BUF_WRITE_FSYNC > 1) {
+      char *dname = Path.dirname (fname);
+      int dfd = open (dname, O_RDONLY);
+      if (NOTOK isnot dfd) {
+        fsync (dfd);
+        close (dfd);
+      }
+      free (dname);
+    }
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  *secs = (end.tv_sec - beg.tv_sec) + (end.tv_nsec - beg.tv_nsec) / 1e9;
+  return OK;
+}
+
+/* for writes that take some time */
+private char *buf_write_throughput (size_t bts, double secs) {
+  static char buf[32];
+  buf[0] = '\0';
+  if (secs >= 0.1)
+    snprintf (buf, 32, " [%.1f MB/s]", (bts / secs) / (1024 * 1024));
+  return buf;
+}
+
 private int buf_write_to_fname (buf_t *this, char *fname, int append, int fidx,
                                             int lidx, int force, int verbose) {
   if (NULL is fname) return NOTHING_TODO;
@@ -12495,26 +15557,16 @@ private int buf_write_to_fname (buf_t *this, char *fname, int append, int fidx,
 
   ifnot (fexists) append = 0;
 
-  FILE *fp = fopen (fnstr->bytes, (append ? "a+" : "w"));
-  if (NULL is fp) {
+  size_t bts = 0;
+  double secs = 0;
+  if (NOTOK is buf_write_rows (this, fnstr->bytes, fidx, lidx, append, &bts, &secs)) {
     MSG_ERRNO (errno);
     goto theend;
   }
 
-  int idx = 0;
-  row_t *it = this->head;
-  while (idx++ < fidx) it = it->next;
-  idx--;
-
-  size_t bts = 0;
-  while (idx++ <= lidx) {
-    bts += fprintf (fp, "%s\n", it->data->bytes);
-    it = it->next;
-  }
-
-  fclose (fp);
   if (verbose)
-    MSG("%s: %zd bytes written%s", fnstr->bytes, bts, (append ? " [appended]" : " "));
+    MSG("%s: %zd bytes written%s%s", fnstr->bytes, bts, (append ? " [appended]" : ""),
+        buf_write_throughput (bts, secs));
 
   retval = DONE;
 
@@ -12567,26 +15619,18 @@ private int buf_write (buf_t *this, int force) {
     }
   }
 
-  FILE *fp = fopen ($my(fname), "w");
-  if (NULL is fp) {
+  size_t bts = 0;
+  double secs = 0;
+  if (NOTOK is buf_write_rows (this, $my(fname), 0, this->num_items - 1, 0, &bts, &secs)) {
     MSG_ERRNO(errno);
     return NOTHING_TODO;
   }
 
-  row_t *row = this->head;
-
-  size_t bts = 0;
-  while (row isnot NULL) {
-    bts += fprintf (fp, "%s\n", row->data->bytes);
-    row = row->next;
-  }
-
   $my(flags) &= ~BUF_IS_MODIFIED;
   $my(flags) |= (FILE_IS_READABLE|FILE_IS_WRITABLE|FILE_EXISTS);
 
-  fstat (fileno (fp), &$my(st));
-  fclose (fp);
-  MSG("%s: %zd bytes written", $my(fname), bts);
+  stat ($my(fname), &$my(st));
+  MSG("%s: %zd bytes written%s", $my(fname), bts, buf_write_throughput (bts, secs));
   return DONE;
 }
 
@@ -12596,11 +15640,12 @@ private int buf_read_from_fp (buf_t *this, FILE *stream, fp_t *fp) {
   row_t *row = this->current;
   Action_t *Action = self(Action.new);
 
-  char *line = NULL;
-  size_t len = 0;
+  fdlines_t fdl;
+  fdlines_init (&fdl, fileno (fp->fp));
+  char *line;
   size_t t_len = 0;
   ssize_t nread;
-  while (-1 isnot (nread = ed_readline_from_fp (&line, &len, fp->fp))) {
+  while (-1 isnot (nread = ed_readline_from_fd (&fdl, &line))) {
     t_len += nread;
     action_t *action = self(action.new);
     undo_set (action, INSERT_LINE);
@@ -12609,7 +15654,7 @@ private int buf_read_from_fp (buf_t *this, FILE *stream, fp_t *fp) {
     stack_push (Action, action);
   }
 
-  ifnot (NULL is line) free (line);
+  fdlines_release (&fdl);
 
   ifnot (t_len)
     free (Action);
@@ -14040,6 +17085,7 @@ private void ed_init_commands (ed_t *this) {
   ed_append_command_arg (this, "set", "--enable-writing", 16);
   ed_append_command_arg (this, "set", "--backup-suffix=", 16);
   ed_append_command_arg (this, "set", "--no-backupfile", 15);
+  ed_append_command_arg (this, "set", "--no-hlsearch", 13);
   ed_append_command_arg (this, "set", "--shiftwidth=", 13);
   ed_append_command_arg (this, "set", "--save-image=", 13);
   ed_append_command_arg (this, "set", "--image-file=", 13);
@@ -14048,7 +17094,9 @@ private void ed_init_commands (ed_t *this) {
   ed_append_command_arg (this, "set", "--lang-mode=", 12);
   ed_append_command_arg (this, "set", "--tabwidth=", 11);
   ed_append_command_arg (this, "set", "--autosave=", 11);
+  ed_append_command_arg (this, "set", "--no-wrap", 9);
   ed_append_command_arg (this, "set", "--ftype=", 8);
+  ed_append_command_arg (this, "set", "--wrap", 6);
   ed_append_command_arg (this, "diff", "--origin", 8);
   ed_append_command_arg (this, "substitute", "--remove-doseol", 15);
   ed_append_command_arg (this, "s%",         "--remove-doseol", 15);
@@ -14169,6 +17217,7 @@ private void rline_write (rline_t *rl) {
     Video.draw.row_at (rl->cur_video, orig_first_row++);
 
   rline_render (rl);
+  video_frame_invalidate (rl->cur_video, rl->first_row, rl->prompt_row);
   fd_write (rl->fd, rl->render->bytes, rl->render->num_bytes);
   rl->state &= ~RL_WRITE;
 }
@@ -15238,6 +18287,8 @@ exec:
 
   rline_parse (rl, this);
 
+  buf_map_load_for_rline (this, rl);
+
   for (int i = 0; i < $myroots(num_rline_cbs); i++) {
     retval = $myroots(rline_cbs)[i] (thisp, rl, rl->com);
     if (retval isnot RLINE_NO_COMMAND) goto theend;
@@ -15706,6 +18757,74 @@ private int buf_insert_reg (buf_t **thisp, string_t *cur_insert) {
   return DONE;
 }
 
+/* the pasted text is inserted as it is (without autoindent), with the
+ * lines as new rows, and the buffer is drawn once */
+private int buf_insert_paste (buf_t *this, Action_t **action) {
+  string_t *paste = String.new (MAXLEN_LINE);
+
+  if (NOTOK is term_input_get_paste ($my(term_ptr), paste) or
+      0 is paste->num_bytes) {
+    String.free (paste);
+    return NOTHING_TODO;
+  }
+
+  char *sp = paste->bytes;
+  char *end = paste->bytes + paste->num_bytes;
+  char *nl = memchr (sp, '\n', end - sp);
+
+  if (NULL is nl) {
+    buf_insert_string (this, sp, end - sp, DONOT_DRAW);
+    $my(flags) |= BUF_IS_MODIFIED;
+    String.free (paste);
+    self(draw);
+    return DONE;
+  }
+
+  if ($mycur(data)->num_bytes) RM_TRAILING_NEW_LINE;
+
+  int idx = this->cur_idx;
+  int col = $mycur(cur_col_idx);
+  if (col > (int) $mycur(data)->num_bytes) col = $mycur(data)->num_bytes;
+
+  string_t *tail = String.new_with_len ($mycur(data)->bytes + col,
+      $mycur(data)->num_bytes - col);
+  String.clear_at ($mycur(data), col);
+  String.append_with_len ($mycur(data), sp, nl - sp);
+
+  int num_chars = 0;
+
+  while (nl) {
+    sp = nl + 1;
+    nl = memchr (sp, '\n', end - sp);
+    size_t len = (NULL is nl ? (size_t) (end - sp) : (size_t) (nl - sp));
+
+    self(current.append_with_len, sp, len);
+    self(adjust.marks, INSERT_LINE, this->cur_idx - 1, this->cur_idx);
+
+    action_t *act = self(action.new);
+    undo_set (act, INSERT_LINE);
+    act->idx = this->cur_idx;
+    stack_push (*action, act);
+
+    if (NULL is nl) num_chars = char_num (sp, len);
+  }
+
+  String.append_with_len ($mycur(data), tail->bytes, tail->num_bytes);
+  String.free (tail);
+  String.free (paste);
+
+  int lidx = this->cur_idx;
+  self(current.set, idx);
+  self(normal.down, lidx - idx, DONOT_ADJUST_COL, DONOT_DRAW);
+
+  if ($mycur(data)->num_bytes) ADD_TRAILING_NEW_LINE;
+  if (num_chars) self(normal.right, num_chars, DONOT_DRAW);
+
+  $my(flags) |= BUF_IS_MODIFIED;
+  self(draw);
+  return DONE;
+}
+
 private utf8 ed_lang_getkey (ed_t *this) {
   if (NULL is $my(lang_getkey) or Cstring.eq ($my(lang_mode), "en"))
     return Input.get ($my(term));
@@ -15771,6 +18890,7 @@ private int buf_insert_mode (buf_t **thisp, utf8 com, char *bytes) {
 
   Cstring.cp ($my(mode), MAXLEN_MODE, INSERT_MODE, MAXLEN_MODE - 1);
   self(set.mode, INSERT_MODE);
+  SEND_ESC_SEQ ($from($my(term_ptr), out_fd), TERM_BRACKETED_PASTE_ON);
 
   if ($my(show_statusline) is UNSET) buf_set_draw_statusline (this);
   buf_set_draw_topline (this);
@@ -15786,6 +18906,11 @@ get_char:
     c = ed_lang_getkey ($my(root));
 
 handle_char:
+    if (c is BRACKETED_PASTE_KEY) {
+      buf_insert_paste (this, &Action);
+      goto get_char;
+    }
+
     if (c > 0x7f)
       if (c < 0x0a0 or (c >= FN_KEY(1) and c <= FN_KEY(12)) or c is INSERT_KEY)
         continue;
@@ -15947,6 +19072,7 @@ new_char:
   }
 
 theend:
+  SEND_ESC_SEQ ($from($my(term_ptr), out_fd), TERM_BRACKETED_PASTE_OFF);
   self(normal.left, 1, DRAW);
   if ($mycur(data)->num_bytes)
     RM_TRAILING_NEW_LINE;
@@ -16736,11 +19862,14 @@ private void ed_syn_append (ed_t *this, syn_t syn) {
       $my(syntaxes)[$my(num_syntaxes)].keywords_colors[i] =
          keyword_colors[whereis_c(c)];
     }
+
+    $my(syntaxes)[$my(num_syntaxes)].keywords_table =
+      syn_keywords_compile (&$my(syntaxes)[$my(num_syntaxes)]);
   }
 
-  ifnot (NULL is $my(syntaxes)[$my(num_syntaxes)].multiline_comment_continuation)
-    $my(syntaxes)[$my(num_syntaxes)].multiline_comment_continuation_len =
-      bytelen ($my(syntaxes)[$my(num_syntaxes)].multiline_comment_continuation);
+  $my(syntaxes)[$my(num_syntaxes)].byte_class =
+    syn_byte_class_compile (&$my(syntaxes)[$my(num_syntaxes)]);
+
   $my(num_syntaxes)++;
 #undef whereis_c
 }
@@ -16796,6 +19925,8 @@ private void ed_free (ed_t *this) {
     for (int i = 0; i < $my(num_syntaxes); i++) {
       free ($my(syntaxes)[i].keywords_len);
       free ($my(syntaxes)[i].keywords_colors);
+      syn_keywords_free (&$my(syntaxes)[i]);
+      free ($my(syntaxes)[i].byte_class);
     }
 
     free ($my(cw_mode_chars)); free ($my(cw_mode_actions));
@@ -16964,6 +20095,8 @@ private void ed_deinit_record (ed_t *this) {
 private int ed_buf_normal_cmd (ed_t *ed, buf_t **thisp, utf8 com, int count, int regidx) {
   buf_t *this = *thisp;
 
+  buf_map_load_for_normal (this, com, count);
+
   if (0 >= count or count > this->num_items)
      return NOTHING_TODO;
 
@@ -17178,19 +20311,35 @@ handle_com:
 
     case ARROW_UP_KEY:
     case 'k':
-      retval = self(normal.up, count, ADJUST_COL, DRAW); break;
+      if ($my(flags) & BUF_SOFT_WRAP)
+        retval = buf_wrap_up (this, count);
+      else
+        retval = self(normal.up, count, ADJUST_COL, DRAW);
+      break;
 
     case ARROW_DOWN_KEY:
     case 'j':
-      retval = self(normal.down, count, ADJUST_COL, DRAW); break;
+      if ($my(flags) & BUF_SOFT_WRAP)
+        retval = buf_wrap_down (this, count);
+      else
+        retval = self(normal.down, count, ADJUST_COL, DRAW);
+      break;
 
     case PAGE_DOWN_KEY:
     case CTRL('f'):
-      retval = self(normal.page_down, count, DRAW); break;
+      if ($my(flags) & BUF_SOFT_WRAP)
+        retval = buf_wrap_page_down (this, count);
+      else
+        retval = self(normal.page_down, count, DRAW);
+      break;
 
     case PAGE_UP_KEY:
     case CTRL('b'):
-      retval = self(normal.page_up, count, DRAW); break;
+      if ($my(flags) & BUF_SOFT_WRAP)
+        retval = buf_wrap_page_up (this, count);
+      else
+        retval = self(normal.page_up, count, DRAW);
+      break;
 
     case HOME_KEY:
       retval = self(normal.bof, DRAW); break;
@@ -17279,6 +20428,33 @@ theend:
     cc;                                   \
     })
 
+/* draws the current buffer, when its draw was deferred */
+private int ed_on_idle_draw (term_t *term, void *obj) {
+  (void) term;
+  ed_t *ed = (ed_t *) obj;
+  if (NULL is ed->current or NULL is ed->current->current) return 0;
+
+  buf_t *this = ed_get_current_buf (ed);
+  if ($my(state) & BUF_DRAW_IS_DEFERRED) self(draw);
+  return 0;
+}
+
+private int ed_on_idle (term_t *term, void *obj) {
+  ed_on_idle_draw (term, obj);
+  ed_t *ed = (ed_t *) obj;
+  if (NULL is ed->current or NULL is ed->current->current) return 0;
+
+  buf_t *buf = ed_get_current_buf (ed);
+  if (buf_map_load_on_idle (term, buf)) return 1;
+  if (buf_match_on_idle (buf)) return 1;
+
+#if BUF_RENDER_ON_IDLE
+  return buf_render_on_idle (term, buf);
+#else
+  return 0;
+#endif
+}
+
 private int ed_loop (ed_t *ed, buf_t *this) {
   int retval = NOTOK;
   int count = 1;
@@ -17293,7 +20469,13 @@ private int ed_loop (ed_t *ed, buf_t *this) {
 
 get_char:
     ed_check_msg_status (ed);
+    Term.set_on_idle ($from(ed, term), ed_on_idle, ed);
     c = Input.get ($my(term_ptr));
+    /* the nested reads (menus, questions, the command line) do not draw the
+     * buffer over them; the object is kept, as the draws are deferred only
+     * within this loop (see buf_draw_is_deferred()), and the deferred draw is
+     * done by ed_on_idle() */
+    Term.set_on_idle ($from(ed, term), NULL, ed);
 
 handle_char:
     switch (c) {
@@ -17363,6 +20545,7 @@ exit_this:
   }
 
 theend:
+  Term.set_on_idle ($from(ed, term), NULL, NULL);
   return retval;
 }
 
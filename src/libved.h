@@ -88,8 +88,44 @@
 #define NUM_SYNTAXES 32
 #endif
 
-#ifndef MAX_BACKTRACK_LINES_FOR_ML_COMMENTS
-#define MAX_BACKTRACK_LINES_FOR_ML_COMMENTS 24
+/* files with equal or bigger size, are read into a single block, and their
+ * lines are referencing this block, until they are modified (0 disables it,
+ * though it can be still set per buffer with the BUF_USE_BLOCK_STORE flag) */
+#ifndef BUF_BLOCK_STORE_MIN_SIZE
+#define BUF_BLOCK_STORE_MIN_SIZE (1 << 20)
+#endif
+
+/* files with equal or bigger size, are mapped into memory and their lines
+ * become rows, only when they are needed (0 disables it, though it can be
+ * still set per buffer with the BUF_USE_MMAP flag) */
+#ifndef BUF_MMAP_MIN_SIZE
+#define BUF_MMAP_MIN_SIZE (1 << 25)
+#endif
+
+/* after writing a buffer: 0 doesn't sync, 1 syncs the file to the disk, and 2
+ * syncs also the directory, so the rename of the temporary file is durable */
+#ifndef BUF_WRITE_FSYNC
+#define BUF_WRITE_FSYNC 1
+#endif
+
+/* while there is pending input (as when pasting or when a key is held down),
+ * the current buffer is drawn at most that many times per second, and once
+ * more when the input is consumed (0 draws it after every command) */
+#ifndef BUF_DRAW_MAX_FPS
+#define BUF_DRAW_MAX_FPS 30
+#endif
+
+/* while waiting for input in normal mode, the rows around the window are
+ * rendered into the cache, and the comment state of the rest of the buffer is
+ * computed, so scrolling finds them ready (0 disables it) */
+#ifndef BUF_RENDER_ON_IDLE
+#define BUF_RENDER_ON_IDLE 1
+#endif
+
+/* :grep searches the files with as many threads as the online processors, but
+ * not more than that many */
+#ifndef GREP_MAX_THREADS
+#define GREP_MAX_THREADS 8
 #endif
 
 #ifndef PATH_MAX
@@ -265,6 +301,10 @@
 #define BUF_FORCE_REOPEN    (1 << 10)
 #define PTR_IS_AT_EOL       (1 << 12)
 #define BUF_LW_RESELECT     (1 << 13)
+#define BUF_USE_BLOCK_STORE (1 << 14)
+#define BUF_USE_MMAP        (1 << 15)
+#define BUF_DRAW_IS_DEFERRED (1 << 16)
+#define BUF_SOFT_WRAP       (1 << 17)
 
 #define ED_SUSPENDED        (1 << 0)
 #define ED_EXIT             (1 << 1)
@@ -313,6 +353,7 @@
 #define INSERT_KEY      0513
 #define PAGE_DOWN_KEY   0522
 #define PAGE_UP_KEY     0523
+#define BRACKETED_PASTE_KEY 0524
 #define END_KEY         0550
 
 #ifndef CTRL
@@ -350,6 +391,7 @@
 
 #define HL_NORMAL         COLOR_NORMAL
 #define HL_VISUAL         COLOR_CYAN
+#define HL_SEARCH         COLOR_YELLOW
 #define HL_IDENTIFIER     COLOR_BLUE
 #define HL_KEYWORD        COLOR_MAGENTA
 #define HL_OPERATOR       COLOR_MAGENTA
@@ -400,6 +442,8 @@
 #define TERM_CURSOR_RESTORE_LEN     2
 #define TERM_LINE_CLR_EOL           "\033[2K"
 #define TERM_LINE_CLR_EOL_LEN       4
+#define TERM_CLR_TO_EOL             "\033[K"
+#define TERM_CLR_TO_EOL_LEN         3
 #define TERM_BOLD                   "\033[1m"
 #define TERM_BOLD_LEN               4
 #define TERM_BELL                   "\033[7"
@@ -414,7 +458,13 @@
 #define TERM_REVERSE_SCREEN_LEN     5
 #define TERM_SCREEN_NORMAL          "\033[?5l"
 #define TERM_SCREEN_NORMAL_LEN      5
+#define TERM_BRACKETED_PASTE_ON     "\033[?2004h"
+#define TERM_BRACKETED_PASTE_ON_LEN 8
+#define TERM_BRACKETED_PASTE_OFF    "\033[?2004l"
+#define TERM_BRACKETED_PASTE_OFF_LEN 8
 #define TERM_SCROLL_REGION_FMT      "\033[%d;%dr"
+#define TERM_INSERT_LINE_FMT        "\033[%dL"
+#define TERM_DELETE_LINE_FMT        "\033[%dM"
 #define TERM_COLOR_RESET            "\033[m"
 #define TERM_COLOR_RESET_LEN        3
 #define TERM_GOTO_PTR_POS_FMT       "\033[%d;%dH"
@@ -439,6 +489,8 @@
 #define RE_IGNORE_CASE               (1 << 0)
 #define RE_ENCLOSE_PAT_IN_PAREN      (1 << 1)
 #define RE_PATTERN_IS_STRING_LITERAL (1 << 2)
+/* the string does not start a line, so '^' does not match at its start */
+#define RE_NOTBOL                    (1 << 3)
 
 #define RE_MAX_NUM_CAPTURES 9
 
@@ -671,6 +723,7 @@ DeclareType (arg);
 DeclareType (row);
 DeclareType (dim);
 DeclareType (syn);
+DeclareType (synkw);
 DeclareType (undo);
 DeclareType (term);
 DeclareType (hist);
@@ -739,6 +792,7 @@ typedef struct ed_opts ed_opts;
  * certainly (easier) searchable */
 
 typedef utf8 (*InputGetch_cb) (term_t *);
+typedef int  (*TermOnIdle_cb) (term_t *, void *);
 typedef int  (*Rline_cb) (buf_t **, rline_t *, utf8);
 typedef int  (*StrChop_cb) (Vstring_t *, char *, void *);
 typedef int  (*FileReadLines_cb) (Vstring_t *, char *, size_t, int, void *);
@@ -845,7 +899,7 @@ NewType (syn,
     *singleline_comment,
     *multiline_comment_start,
     *multiline_comment_end,
-    *multiline_comment_continuation;
+    *multiline_comment_continuation; /* unused, kept for the order */
 
   int
     hl_strings,
@@ -857,11 +911,14 @@ NewType (syn,
   int state;
 
   size_t
-     multiline_comment_continuation_len,
+     multiline_comment_continuation_len, /* unused */
     *keywords_len,
     *keywords_colors;
 
   char *balanced_pairs;
+
+  synkw_t *keywords_table;
+  uchar   *byte_class;
 );
 
 NewType (ftype,
@@ -950,6 +1007,9 @@ NewType (regexp,
   char *match_ptr;
   string_t *match;
   char errmsg[RE_MAXLEN_ERR_MSG];
+
+  /* the parsed pattern (see re_compile()) */
+  struct regex_info *prog;
 );
 
 NewType (bufiter,
@@ -981,6 +1041,10 @@ NewType (Ustring,
       int  cur_idx;
       int  num_items;
       int  len;
+
+  /* the characters are linked, but they are allocated in this array */
+  ustring_t *nodes;
+      int  mem_size;
 );
 
 NewType (balanced,
@@ -1256,6 +1320,7 @@ NewSelf (term,
     (*free) (term_t **),
     (*restore) (term_t *),
     (*set_name) (term_t *),
+    (*set_on_idle) (term_t *, TermOnIdle_cb, void *),
     (*init_size) (term_t *, int *, int *),
     (*set_state_bit) (term_t *, int),
     (*unset_state_bit) (term_t *, int);